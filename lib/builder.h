@@ -0,0 +1,265 @@
+#pragma once
+
+#include "data.h"
+#include <deque>
+#include <queue>
+
+namespace sipm4eic {
+
+/*******************************************************************************/
+
+/**
+    streaming event builder
+
+    the decoded FIFO files are read as time-ordered streams and merged on the fly.
+    an event is the time window [t - before, t + after] around each trigger tag of
+    the trigger device, and it is emitted as soon as the merge watermark (the
+    smallest head time of the streams) has passed the end of its window.
+    only the hits within the windows of the pending triggers are kept in memory,
+    hence the memory is bounded by the window size times the hit rate.
+
+    the streams are expected to be time-ordered up to a reorder slack: an entry may
+    arrive up to slack clocks earlier than the latest merged one, e.g. trigger tags
+    moved by set_trigger_coarse_offset. windows are emitted slack clocks later and
+    entries are inserted in time order. entries beyond the slack are counted as late,
+    they are dropped if no pending window can use them anymore
+**/
+
+class builder {
+
+public:
+
+  builder(std::vector<std::string> filenames, int before = 128, int after = 128, int trigger_device = 192) :
+    _filenames(filenames), _before(before), _after(after), _trigger_device(trigger_device), _verbose(false) { };
+  ~builder();
+
+  bool next_spill();
+  bool next_event();
+  void verbose(bool flag = true) { _verbose = flag; };
+
+  typedef struct {
+    data trigger;
+    std::vector<data> triggers;
+    std::vector<data> hits;
+  } event_t;
+
+  event_t &event() { return _event; };
+  std::map<int, unsigned int> &part_mask() { return _part_mask; };
+  std::map<int, unsigned int> &dead_mask() { return _dead_mask; };
+  size_t buffer_size() const { return _buffer.size(); };
+
+  void set_trigger_coarse_offset(int device, int offset) { _trigger_coarse_offset[device] = offset; };
+  void set_reorder_slack(int slack) { _slack = slack; };
+  long long late_entries() const { return _late_entries; };
+  long long late_dropped() const { return _late_dropped; };
+
+private:
+
+  typedef struct {
+    TFile *file;
+    TTree *tree;
+    data head;
+    long long entry;
+    long long nentries;
+  } stream_t;
+
+  bool advance(stream_t &stream);
+  int time(const data &hit) const { return hit.coarse_time_clock(); };
+  void insert(std::deque<data> &queue, const data &hit);
+  void prune(int horizon);
+
+  bool _verbose;
+  int _before;
+  int _after;
+  int _trigger_device;
+  std::vector<std::string> _filenames;
+  std::vector<stream_t> _streams;
+  std::map<int, unsigned int> _part_mask;
+  std::map<int, unsigned int> _dead_mask;
+  std::map<int, int> _trigger_coarse_offset;
+
+  int _slack = 0;
+  bool _merged = false;
+  int _watermark = 0; // latest time merged in the spill
+  int _horizon = 0;   // entries before this time have been dropped
+  long long _late_entries = 0;
+  long long _late_dropped = 0;
+
+  /** min-heap of the stream indices ordered by their head time **/
+  std::function<bool(int, int)> _later = [this](int a, int b) { return time(_streams[a].head) > time(_streams[b].head); };
+  std::priority_queue<int, std::vector<int>, std::function<bool(int, int)>> _heap{_later};
+
+  std::deque<data> _pending; // triggers waiting for their window to complete
+  std::deque<data> _buffer;  // hits and triggers, in merge order
+  event_t _event;
+
+};
+
+/*******************************************************************************/
+
+builder::~builder()
+{
+  for (auto &stream : _streams)
+    stream.file->Close();
+}
+
+/**
+    reads the next hit or trigger of the stream into its head,
+    returns false at the end of the spill
+**/
+
+bool builder::advance(stream_t &stream)
+{
+  for (; stream.entry < stream.nentries; ) {
+    stream.tree->GetEntry(stream.entry++);
+    auto &hit = stream.head;
+
+    if (hit.is_start_spill()) {
+      if (_verbose) std::cout << " --- start of spill found: event " << stream.entry - 1 << std::endl;
+      if (!_part_mask.count(hit.device)) _part_mask[hit.device] = 0x0;
+      _part_mask[hit.device] |= (1 << hit.fifo);
+      if (hit.coarse_time_clock() == 0xdeadbeef) {
+        if (!_dead_mask.count(hit.device)) _dead_mask[hit.device] = 0x0;
+        _dead_mask[hit.device] |= (1 << hit.fifo);
+      }
+      continue;
+    }
+
+    if (hit.is_end_spill()) {
+      if (_verbose) std::cout << " --- end of spill found: event " << stream.entry - 1 << std::endl;
+      return false;
+    }
+
+    if (hit.is_trigger_tag()) {
+      if (_trigger_coarse_offset.count(hit.device))
+        hit.coarse -= _trigger_coarse_offset[hit.device];
+      return true;
+    }
+
+    if (hit.is_alcor_hit())
+      return true;
+  }
+  return false;
+}
+
+bool builder::next_spill()
+{
+  _part_mask.clear();
+  _dead_mask.clear();
+  _pending.clear();
+  _buffer.clear();
+  _heap = decltype(_heap)(_later);
+  _merged = false;
+  _late_entries = 0;
+  _late_dropped = 0;
+
+  /** open the streams once **/
+  if (_streams.empty()) {
+    for (const auto &filename : _filenames) {
+      if (gSystem->AccessPathName(filename.c_str())) {
+        if (_verbose) std::cout << "     file does not exist: " << filename << std::endl;
+        continue;
+      }
+      auto fin = TFile::Open(filename.c_str());
+      if (!fin || !fin->IsOpen()) continue;
+      auto tin = (TTree *)fin->Get("alcor");
+      _streams.push_back({fin, tin, data(), 0, tin->GetEntries()});
+    }
+    for (auto &stream : _streams)
+      stream.head.link_to_tree(stream.tree);
+  }
+
+  /** prime the merge with the first hit of each stream **/
+  bool has_data = false;
+  for (int i = 0; i < _streams.size(); ++i) {
+    auto &stream = _streams[i];
+    if (stream.entry < stream.nentries) has_data = true;
+    if (advance(stream)) _heap.push(i);
+  }
+
+  return has_data;
+}
+
+/** inserts in time order, after the entries with the same time **/
+void builder::insert(std::deque<data> &queue, const data &hit)
+{
+  auto it = queue.end();
+  while (it != queue.begin() && time(*(it - 1)) > time(hit)) --it;
+  queue.insert(it, hit);
+}
+
+void builder::prune(int horizon)
+{
+  if (horizon <= _horizon) return;
+  _horizon = horizon;
+  while (!_buffer.empty() && time(_buffer.front()) < _horizon)
+    _buffer.pop_front();
+}
+
+bool builder::next_event()
+{
+  while (true) {
+
+    /** emit the oldest pending trigger once the watermark has passed its window and the slack **/
+    if (!_pending.empty() && (_heap.empty() || time(_streams[_heap.top()].head) > time(_pending.front()) + _after + _slack)) {
+      _event.trigger = _pending.front();
+      _event.triggers.clear();
+      _event.hits.clear();
+      auto tmin = time(_event.trigger) - _before;
+      auto tmax = time(_event.trigger) + _after;
+      for (auto &hit : _buffer) {
+        auto t = time(hit);
+        if (t < tmin) continue;
+        if (t > tmax) break;
+        if (hit.is_trigger_tag()) _event.triggers.push_back(hit);
+        else _event.hits.push_back(hit);
+      }
+      _pending.pop_front();
+
+      /** drop hits that no pending or future window can use anymore **/
+      auto horizon = _watermark - _slack;
+      if (!_pending.empty()) horizon = std::min(horizon, time(_pending.front()));
+      prune(horizon - _before);
+      return true;
+    }
+
+    if (_heap.empty()) {
+      if (_verbose && _late_entries > 0)
+        std::cout << " --- WARNING: " << _late_entries << " entries beyond the reorder slack of " << _slack << " clocks, "
+                  << _late_dropped << " dropped " << std::endl;
+      return false;
+    }
+
+    /** move the earliest head to the buffers and refill its stream **/
+    auto i = _heap.top();
+    _heap.pop();
+    auto hit = _streams[i].head;
+    if (advance(_streams[i])) _heap.push(i);
+
+    auto t = time(hit);
+    if (!_merged) {
+      _merged = true;
+      _watermark = t;
+      _horizon = t - _before - _slack;
+    }
+    if (t < _watermark - _slack) ++_late_entries;
+    _watermark = std::max(_watermark, t);
+
+    /** a late trigger whose window was already pruned, or a late hit, cannot be used **/
+    bool window = hit.is_trigger_tag() && hit.device == _trigger_device;
+    if (t < _horizon || (window && t - _before < _horizon)) {
+      ++_late_dropped;
+      if (t < _horizon) continue;
+      window = false;
+    }
+
+    if (window) insert(_pending, hit);
+    insert(_buffer, hit);
+
+    /** without pending triggers only the last window before the watermark is needed **/
+    if (_pending.empty())
+      prune(_watermark - _before - _slack);
+  }
+}
+
+} /** namespace sipm4eic **/
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "lightdata.h"
+#include "calibration.h"
+#include <fstream>
+#include <sstream>
+
+namespace sipm4eic {
+
+/**
+    content hash of the inputs of a pipeline stage
+
+    the hash accumulates the identity of the input files, the calibration
+    tables, the selection parameters and the source code of the stage.
+    the hash of a stage output is stored next to it in a <output>.hash file,
+    downstream stages add it to their own hash so that a change anywhere
+    upstream invalidates the whole chain below it
+**/
+
+class stagehash {
+
+public:
+
+  stagehash &add(const void *buffer, size_t size);
+  stagehash &add(const std::string &value) { return add(value.data(), value.size()); };
+  stagehash &add(double value) { return add(&value, sizeof(value)); };
+  stagehash &add_file_identity(const std::string &filename);
+  stagehash &add_file_content(const std::string &filename);
+  stagehash &add_upstream(const std::string &outfilename);
+  stagehash &add_calibration(const calibration &calib) { return add(&calib.payload(), sizeof(calibration::payload_t)); };
+
+  unsigned long long value() const { return _value; };
+  std::string hex() const;
+
+  bool cached(const std::string &outfilename) const;
+  void store(const std::string &outfilename) const;
+  static std::string load(const std::string &outfilename);
+
+private:
+
+  unsigned long long _value = 0xcbf29ce484222325ULL; // FNV-1a 64-bit offset basis
+
+};
+
+/** FNV-1a **/
+stagehash &
+stagehash::add(const void *buffer, size_t size)
+{
+  auto bytes = (const unsigned char *)buffer;
+  for (size_t i = 0; i < size; ++i) {
+    _value ^= bytes[i];
+    _value *= 0x100000001b3ULL;
+  }
+  return *this;
+}
+
+/** file name, size and modification time, cheap for large data files **/
+stagehash &
+stagehash::add_file_identity(const std::string &filename)
+{
+  add(filename);
+  FileStat_t stat;
+  if (gSystem->GetPathInfo(filename.c_str(), stat) != 0) return add(std::string("missing"));
+  Long64_t size = stat.fSize;
+  Long_t mtime = stat.fMtime;
+  add(&size, sizeof(size));
+  return add(&mtime, sizeof(mtime));
+}
+
+/** full content, used for the source code that defines the stage **/
+stagehash &
+stagehash::add_file_content(const std::string &filename)
+{
+  std::ifstream fin(filename, std::ios::binary);
+  if (!fin.is_open()) return add(filename + ":missing");
+  std::stringstream buffer;
+  buffer << fin.rdbuf();
+  return add(buffer.str());
+}
+
+stagehash &
+stagehash::add_upstream(const std::string &outfilename)
+{
+  return add(outfilename + ":" + load(outfilename));
+}
+
+std::string
+stagehash::hex() const
+{
+  char buffer[17];
+  snprintf(buffer, sizeof(buffer), "%016llx", _value);
+  return buffer;
+}
+
+std::string
+stagehash::load(const std::string &outfilename)
+{
+  std::ifstream fin(outfilename + ".hash");
+  std::string hash;
+  if (fin.is_open()) fin >> hash;
+  return hash;
+}
+
+bool
+stagehash::cached(const std::string &outfilename) const
+{
+  if (gSystem->AccessPathName(outfilename.c_str())) return false;
+  return load(outfilename) == hex();
+}
+
+void
+stagehash::store(const std::string &outfilename) const
+{
+  std::ofstream fout(outfilename + ".hash");
+  fout << hex() << std::endl;
+}
+
+} /** namespace sipm4eic **/
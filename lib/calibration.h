@@ -0,0 +1,205 @@
+#pragma once
+
+#include <memory>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sipm4eic {
+
+/**
+    fine time calibration store
+
+    holds both calibrations used in the analysis
+    - the lightdata tables (IIF, CUT, OFF) per device [16][768] from hIIF_%d/hCUT_%d/hOFF_%d
+    - the data tables (MIN, MAX, OFF) [768] from hFine_min/hFine_max/hFine_off
+
+    the tables can be loaded from the ROOT histograms or from a compact versioned
+    binary file. a binary file is mapped read-only, so that parallel jobs share
+    the same physical pages. the store is passed explicitly to the time
+    computations, several calibrations can be used at the same time
+**/
+
+class calibration {
+
+public:
+
+  static const unsigned int magic = 0x43453453; // "S4EC"
+  static const unsigned int version = 1;
+
+  typedef struct {
+    unsigned int magic;
+    unsigned int version;
+    float fine_iif[16][768];
+    float fine_cut[16][768];
+    float fine_off[16][768];
+    double fine_min[768];
+    double fine_max[768];
+    double fine_min_max_off[768];
+  } payload_t;
+
+  calibration() { reset(); };
+  calibration(const calibration &) = delete;
+  calibration &operator=(const calibration &) = delete;
+  ~calibration() { unmap(); };
+
+  bool load(std::string filename);
+  bool load_lightdata_calibration(std::string filename);
+  bool load_data_calibration(std::string filename);
+  bool write_binary(std::string filename) const;
+  bool map_binary(std::string filename);
+  void reset();
+
+  const payload_t &payload() const { return *_payload; };
+
+  float iif(int di, int ci) const { return _payload->fine_iif[di][ci]; };
+  float cut(int di, int ci) const { return _payload->fine_cut[di][ci]; };
+  float off(int di, int ci) const { return _payload->fine_off[di][ci]; };
+  double fine_min(int index) const { return _payload->fine_min[index]; };
+  double fine_max(int index) const { return _payload->fine_max[index]; };
+  double fine_off(int index) const { return _payload->fine_min_max_off[index]; };
+
+private:
+
+  void unmap();
+  payload_t *writable();
+
+  const payload_t *_payload = nullptr;
+  std::unique_ptr<payload_t> _owned;
+  void *_mapped = nullptr;
+
+};
+
+/*******************************************************************************/
+
+void
+calibration::reset()
+{
+  unmap();
+  _owned.reset(new payload_t());
+  _owned->magic = magic;
+  _owned->version = version;
+  _payload = _owned.get();
+}
+
+void
+calibration::unmap()
+{
+  if (!_mapped) return;
+  munmap(_mapped, sizeof(payload_t));
+  _mapped = nullptr;
+  _payload = _owned.get();
+}
+
+/** a mapped store is read-only, loading copies it to owned memory first **/
+calibration::payload_t *
+calibration::writable()
+{
+  if (_mapped) {
+    auto copy = new payload_t(*_payload);
+    unmap();
+    _owned.reset(copy);
+    _payload = copy;
+  }
+  return _owned.get();
+}
+
+/** ROOT files are read as lightdata calibration, anything else as binary store **/
+bool
+calibration::load(std::string filename)
+{
+  auto ext = filename.size() > 5 ? filename.substr(filename.size() - 5) : "";
+  if (ext == ".root") return load_lightdata_calibration(filename);
+  return map_binary(filename);
+}
+
+bool
+calibration::load_lightdata_calibration(std::string filename)
+{
+  std::cout << " --- loading fine calibration: " << filename << std::endl;
+  auto fin = TFile::Open(filename.c_str());
+  if (!fin || !fin->IsOpen()) return false;
+  auto p = writable();
+  for (int i = 0; i < 16; ++i) {
+    auto device = 192 + i;
+    auto hFine_iif = (TH1 *)fin->Get(Form("hIIF_%d", device));
+    auto hFine_cut = (TH1 *)fin->Get(Form("hCUT_%d", device));
+    auto hFine_off = (TH1 *)fin->Get(Form("hOFF_%d", device));
+    for (int j = 0; j < 768; ++j) {
+      p->fine_iif[i][j] = hFine_iif ? hFine_iif->GetBinContent(j + 1) : 0.;
+      p->fine_cut[i][j] = hFine_cut ? hFine_cut->GetBinContent(j + 1) : 0.;
+      p->fine_off[i][j] = hFine_off ? hFine_off->GetBinContent(j + 1) : -p->fine_cut[i][j] * p->fine_iif[i][j];
+    }
+  }
+  fin->Close();
+  return true;
+}
+
+bool
+calibration::load_data_calibration(std::string filename)
+{
+  std::cout << " --- loading fine calibration: " << filename << std::endl;
+  auto fin = TFile::Open(filename.c_str());
+  if (!fin || !fin->IsOpen()) return false;
+  auto hFine_min = (TH1 *)fin->Get("hFine_min");
+  auto hFine_max = (TH1 *)fin->Get("hFine_max");
+  auto hFine_off = (TH1 *)fin->Get("hFine_off");
+  if (!hFine_min || !hFine_max) {
+    fin->Close();
+    return false;
+  }
+  auto p = writable();
+  int found = 0;
+  for (int i = 0; i < 768; ++i) {
+    if (hFine_min->GetBinError(i + 1) <= 0. ||
+        hFine_max->GetBinError(i + 1) <= 0.) continue;
+    p->fine_min[i] = hFine_min->GetBinContent(i + 1);
+    p->fine_max[i] = hFine_max->GetBinContent(i + 1);
+    p->fine_min_max_off[i] = hFine_off ? hFine_off->GetBinContent(i + 1) : 0.;
+    found++;
+  }
+  fin->Close();
+  std::cout << " --- loaded fine calibration: found " << found << " channels " << std::endl;
+  return true;
+}
+
+bool
+calibration::write_binary(std::string filename) const
+{
+  std::cout << " --- writing fine calibration store: " << filename << std::endl;
+  auto fout = fopen(filename.c_str(), "wb");
+  if (!fout) return false;
+  auto written = fwrite(_payload, sizeof(payload_t), 1, fout);
+  fclose(fout);
+  return written == 1;
+}
+
+bool
+calibration::map_binary(std::string filename)
+{
+  std::cout << " --- mapping fine calibration store: " << filename << std::endl;
+  auto fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size != sizeof(payload_t)) {
+    std::cout << " --- invalid fine calibration store size: " << filename << std::endl;
+    close(fd);
+    return false;
+  }
+  auto mapped = mmap(nullptr, sizeof(payload_t), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (mapped == MAP_FAILED) return false;
+  auto p = (const payload_t *)mapped;
+  if (p->magic != magic || p->version != version) {
+    std::cout << " --- unsupported fine calibration store version: " << p->version << std::endl;
+    munmap(mapped, sizeof(payload_t));
+    return false;
+  }
+  unmap();
+  _mapped = mapped;
+  _payload = p;
+  return true;
+}
+
+} /** namespace sipm4eic **/
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "calibration.h"
+
 namespace sipm4eic
 {
 
@@ -20,7 +22,16 @@ namespace sipm4eic
     int coarse;
     int fine;
 
+    /** time key **/
+
+    static const int time_key_bits = 12; // fractional bits of the fixed-point fine time
+    long long time_key = 0;              // fixed-point fine_time_clock(), computed once by update_time_key()
+    void update_time_key() { time_key = std::llround(fine_time_clock() * (1 << time_key_bits)); };
+    void update_time_key(const calibration &calib) { time_key = std::llround(fine_time_clock(calib) * (1 << time_key_bits)); };
+    static void sort(std::vector<data> &hits);
+    
     bool operator<(const data &rhs) const { return fine_time_clock() < rhs.fine_time_clock(); };
+    static bool key_less(const data &lhs, const data &rhs) { return lhs.time_key < rhs.time_key; };
 
     /** calibration **/
 
@@ -28,6 +39,7 @@ namespace sipm4eic
     static double fine_max[768];
     static double fine_off[768];
     static bool load_fine_calibration(std::string filename);
+    static void set_fine_calibration(const calibration &calib);
 
     static bool close_to_cut(int _index, int _fine, int dist = 1) {
       if (_fine == 0.) return false;      
@@ -39,16 +51,22 @@ namespace sipm4eic
       return false;
     }
     
-    static double fine_phase(int _index, int _fine, bool _nice = true) {
+    static double fine_phase(double min, double max, int _fine, bool _nice) {
       if (_fine == 0.) return 0.;
-      double min = fine_min[_index];
-      double max = fine_max[_index];
       if (min == 0. || max == 0.) return 0.;
       double phase = (_fine - min) / (max - min);
       if (_nice && _fine >= 0.5 * (max + min)) phase -= 1.;
       return phase;
     }
 
+    static double fine_phase(int _index, int _fine, bool _nice = true) {
+      return fine_phase(fine_min[_index], fine_max[_index], _fine, _nice);
+    }
+
+    static double fine_phase(const calibration &calib, int _index, int _fine, bool _nice = true) {
+      return fine_phase(calib.fine_min(_index), calib.fine_max(_index), _fine, _nice);
+    }
+
     static double fine_offset(int index) {
       return fine_off[index];
     }
@@ -67,6 +85,9 @@ namespace sipm4eic
       auto index = calib_index();
       return fine_offset(index);
     }
+
+    double fine_phase(const calibration &calib) const { return fine_phase(calib, calib_index(), fine); }
+    double fine_offset(const calibration &calib) const { return calib.fine_off(calib_index()); }
     
     /** indices **/
 
@@ -89,6 +110,8 @@ namespace sipm4eic
 
     double fine_time_clock() const { return coarse_time_clock() - fine_phase(); };
     double fine_time_ns() const { return coarse_time_ns() - fine_phase() * coarse_to_ns - fine_offset(); };
+    double fine_time_clock(const calibration &calib) const { return coarse_time_clock() - fine_phase(calib); };
+    double fine_time_ns(const calibration &calib) const { return coarse_time_ns() - fine_phase(calib) * coarse_to_ns - fine_offset(calib); };
     
     
     /** hit type **/
@@ -136,24 +159,59 @@ namespace sipm4eic
     t->SetBranchAddress("fine", &fine);
   }
 
-  bool data::load_fine_calibration(std::string filename)
+  /** 
+      time-orders hits by their time key with a LSD radix sort,
+      the number of 8-bit passes is set by the key range in the vector.
+      update_time_key() must have been called on all hits, the keys are
+      only used here, operator< still compares fine_time_clock().
+      the sort is stable, hits with equal keys keep their order
+  **/
+  void data::sort(std::vector<data> &hits)
   {
-    std::cout << " --- loading fine calibration: " << filename << std::endl;
-    auto fin = TFile::Open(filename.c_str());
-    auto hFine_min = (TH1 *)fin->Get("hFine_min");
-    auto hFine_max = (TH1 *)fin->Get("hFine_max");
-    auto hFine_off = (TH1 *)fin->Get("hFine_off");
-    int found = 0;
-    for (int i = 0; i < 768; ++i) {
-      if (hFine_min->GetBinError(i + 1) <= 0. ||
-          hFine_max->GetBinError(i + 1) <= 0.) continue;
-      fine_min[i] = hFine_min ? hFine_min->GetBinContent(i + 1) : 0.;
-      fine_max[i] = hFine_max ? hFine_max->GetBinContent(i + 1) : 0.;
-      fine_off[i] = hFine_off ? hFine_off->GetBinContent(i + 1) : 0.;
-    found++;
+    auto n = hits.size();
+    if (n < 64) {
+      std::stable_sort(hits.begin(), hits.end(), key_less);
+      return;
+    }
+    
+    auto kminmax = std::minmax_element(hits.begin(), hits.end(), key_less);
+    auto kmin = kminmax.first->time_key;
+    unsigned long long range = kminmax.second->time_key - kmin;
+    int npasses = 0;
+    for (; range > 0; range >>= 8) ++npasses;
+    
+    std::vector<data> buffer(n);
+    auto src = &hits, dst = &buffer;
+    for (int ipass = 0; ipass < npasses; ++ipass) {
+      int shift = 8 * ipass;
+      size_t count[257] = {0};
+      for (const auto &hit : *src)
+        ++count[(((unsigned long long)(hit.time_key - kmin) >> shift) & 0xff) + 1];
+      for (int i = 0; i < 256; ++i)
+        count[i + 1] += count[i];
+      for (const auto &hit : *src)
+        (*dst)[count[((unsigned long long)(hit.time_key - kmin) >> shift) & 0xff]++] = hit;
+      std::swap(src, dst);
     }
-    std::cout << " --- loaded fine calibration: found " << found << " channels " << std::endl;
+    if (src != &hits) hits.swap(buffer);
+  }
+
+  /** reads the ROOT tables through calibration, the static tables are a copy **/
+  bool data::load_fine_calibration(std::string filename)
+  {
+    calibration calib;
+    if (!calib.load_data_calibration(filename)) return false;
+    set_fine_calibration(calib);
     return true;
   }
+
+  /** copies the tables of a calibration store, either ROOT or binary, to the static tables **/
+  void data::set_fine_calibration(const calibration &calib)
+  {
+    auto &p = calib.payload();
+    std::copy(p.fine_min, p.fine_min + 768, fine_min);
+    std::copy(p.fine_max, p.fine_max + 768, fine_max);
+    std::copy(p.fine_min_max_off, p.fine_min_max_off + 768, fine_off);
+  }
   
 } /** namespace sipm4eic **/
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "data.h"
+#include <array>
+#include <deque>
+#include <fstream>
+#include <set>
 
 namespace sipm4eic {
 
@@ -17,6 +21,8 @@ public:
   };
   
   bool next_spill();
+  bool spill_ready();
+  void sort();
   void verbose(bool flag = true) { _verbose = flag; };
   
   typedef std::vector<data> channel_t;
@@ -26,14 +32,49 @@ public:
     std::vector<data> triggers;
   } device_t;
   typedef std::map<int, device_t> frame_t;
+  typedef std::function<bool(int, frame_t &)> selection_t;
   
   std::map<int, frame_t> &frames() { return _frames; };
   std::map<int, unsigned int> &part_mask() { return _part_mask; };
   std::map<int, unsigned int> &dead_mask() { return _dead_mask; };
   
   void set_trigger_coarse_offset(int device, int offset) { _trigger_coarse_offset[device] = offset; };
+
+  /** calibration used for the hit time keys, the data statics otherwise. the keys are stamped at ingest, it applies to the spills read afterwards **/
+  void set_calibration(const calibration *calib) { _calibration = calib; };
+
+  /** 
+      frame selection pushdown: the files of the selection devices are read first
+      and the selection is evaluated on the frames they build; the other devices
+      then only store hits that belong to accepted frames
+  **/
+  void set_frame_selection(std::vector<int> devices, selection_t selection) { _selection_devices = devices; _selection = selection; };
+
+  /** 
+      noisy channel suppression: the hit counts of each {device, chip, channel} are
+      averaged over the last nspills spills, channels above max_rate hits per spill
+      are flagged and their hits dropped at ingest from the next spill on.
+      channels listed in a mask file ("device chip channel" per line) are always dropped.
+      the per-hit counters and mask bits are dense tables indexed [device - 192][chip][channel],
+      hits of channels outside the tables are neither counted nor masked
+  **/
+  typedef std::array<int, 3> channel_id_t;
+  void set_noisy_rate(float max_rate, int nspills = 10) { _noisy_rate = max_rate; _noisy_spills = nspills; };
+  bool load_channel_mask(std::string filename);
+  std::set<channel_id_t> &masked_channels() { return _masked; };
   
 private:
+
+  enum pass_t { all_devices, selection_devices, other_devices };
+  bool read_spill(const std::string &filename, pass_t pass);
+  bool is_selection_device(int device) const { return std::find(_selection_devices.begin(), _selection_devices.end(), device) != _selection_devices.end(); };
+
+  static const int n_channel_ids = 16 * 8 * 32;
+  static int channel_index(int device, int chip, int channel) {
+    if (device < 192 || device > 207 || chip < 0 || chip > 7 || channel < 0 || channel > 31) return -1;
+    return ((device - 192) * 8 + chip) * 32 + channel;
+  }
+  static channel_id_t channel_id(int index) { return {192 + index / 256, (index / 32) % 8, index % 32}; };
   
   bool _verbose;
   int _frame_size;
@@ -44,6 +85,25 @@ private:
   std::map<int, unsigned int> _dead_mask;
 
   std::map<int, int> _trigger_coarse_offset;
+
+  const calibration *_calibration = nullptr;
+  std::vector<int> _selection_devices;
+  selection_t _selection;
+  std::map<std::string, int> _file_device;
+
+  float _noisy_rate = 0.;
+  int _noisy_spills = 10;
+  std::set<channel_id_t> _mask_file;
+  std::set<channel_id_t> _noisy;
+  std::set<channel_id_t> _masked;
+  std::array<int, n_channel_ids> _spill_counts = {};
+  std::array<bool, n_channel_ids> _masked_bits = {};
+  std::deque<std::map<channel_id_t, int>> _window_counts;
+  std::map<channel_id_t, int> _window_sum;
+  void update_noisy();
+
+  std::map<std::string, int> _scan_next;
+  std::map<std::string, int> _spill_end;
   
 };
   
@@ -55,79 +115,252 @@ bool framer::next_spill()
   _frames.clear();
   _part_mask.clear();
   _dead_mask.clear();
+  _spill_counts.fill(0);
+
+  /** channels dropped in this spill **/
+  _masked = _mask_file;
+  _masked.insert(_noisy.begin(), _noisy.end());
+  _masked_bits.fill(false);
+  for (auto &channel : _masked) {
+    auto index = channel_index(channel[0], channel[1], channel[2]);
+    if (index >= 0) _masked_bits[index] = true;
+  }
+
+  /** no selection, single pass over input file list **/
+  if (!_selection) {
+    for (const auto &filename : _filenames)
+      has_data |= read_spill(filename, all_devices);
+    if (has_data) update_noisy();
+    return has_data;
+  }
+
+  /** first pass over the selection devices **/
+  for (const auto &filename : _filenames)
+    has_data |= read_spill(filename, selection_devices);
+
+  /** evaluate frame selection **/
+  auto n_frames = _frames.size();
+  for (auto it = _frames.begin(); it != _frames.end(); ) {
+    if (_selection(it->first, it->second)) ++it;
+    else it = _frames.erase(it);
+  }
+  if (_verbose) std::cout << " --- frame selection: accepted " << _frames.size() << " / " << n_frames << " frames " << std::endl;
   
-  /** loop over input file list **/
-  for (const auto filename : _filenames) {
-    
-    /** open file **/
-    if (_verbose) std::cout << " --- opening decoded file: " << filename << std::endl;
-    if (gSystem->AccessPathName(filename.c_str())) {
-      if (_verbose) std::cout << "     file does not exist: " << filename << std::endl;    continue;
+  /** second pass over the other devices **/
+  for (const auto &filename : _filenames)
+    has_data |= read_spill(filename, other_devices);
+  
+  if (has_data) update_noisy();
+  return has_data;
+}
+
+/** slides the rate window by one spill and flags the channels above threshold **/
+void framer::update_noisy()
+{
+  if (_noisy_rate <= 0.) return;
+  
+  std::map<channel_id_t, int> spill_counts;
+  for (int index = 0; index < n_channel_ids; ++index)
+    if (_spill_counts[index] > 0) spill_counts[channel_id(index)] = _spill_counts[index];
+  _window_counts.push_back(spill_counts);
+  for (auto &[channel, counts] : spill_counts)
+    _window_sum[channel] += counts;
+  if (_window_counts.size() > _noisy_spills) {
+    for (auto &[channel, counts] : _window_counts.front())
+      _window_sum[channel] -= counts;
+    _window_counts.pop_front();
+  }
+
+  _noisy.clear();
+  float nspills = _window_counts.size();
+  for (auto &[channel, counts] : _window_sum) {
+    if (counts / nspills <= _noisy_rate) continue;
+    if (_verbose && !_masked.count(channel))
+      std::cout << " --- noisy channel: device=" << channel[0] << " chip=" << channel[1] << " channel=" << channel[2] << " rate=" << counts / nspills << " hits/spill" << std::endl;
+    _noisy.insert(channel);
+  }
+}
+
+bool framer::load_channel_mask(std::string filename)
+{
+  std::cout << " --- loading channel mask: " << filename << std::endl;
+  std::ifstream fin(filename);
+  if (!fin.is_open()) return false;
+  int device, chip, channel;
+  while (fin >> device >> chip >> channel) {
+    if (channel_index(device, chip, channel) < 0) {
+      std::cout << " --- WARNING: channel mask entry out of range: device=" << device << " chip=" << chip << " channel=" << channel << std::endl;
+      continue;
+    }
+    _mask_file.insert({device, chip, channel});
+  }
+  std::cout << " --- loaded channel mask: " << _mask_file.size() << " channels " << std::endl;
+  return true;
+}
+
+/** 
+    follow mode for files that are still being written: returns true when every
+    existing file holds a complete spill (up to its end of spill marker) after the
+    last consumed one, so that next_spill() can run. the scan resumes where the
+    previous call stopped and only reads the type branch
+**/
+bool framer::spill_ready()
+{
+  bool ready = false;
+  for (const auto &filename : _filenames) {
+    if (gSystem->AccessPathName(filename.c_str())) continue;
+    if (_spill_end.count(filename) && _spill_end[filename] >= _next_spill[filename]) {
+      ready = true;
+      continue;
     }
-    auto fin = TFile::Open(filename.c_str());
-    if (!fin || !fin->IsOpen()) continue;
     
-    /** retrieve tree and link it **/
+    auto fin = TFile::Open(filename.c_str());
+    if (!fin || !fin->IsOpen()) return false;
     auto tin = (TTree *)fin->Get("alcor");
-    auto nev = tin->GetEntries();
-    if (_verbose) std::cout << " --- found " << nev << " entries in tree " << std::endl;
-    sipm4eic::data data;
-    data.link_to_tree(tin);
+    if (!tin) {
+      fin->Close();
+      return false;
+    }
+    int type;
+    tin->SetBranchStatus("*", false);
+    tin->SetBranchStatus("type", true);
+    tin->SetBranchAddress("type", &type);
     
-    /** loop over events in tree **/
-    for (int iev = _next_spill[filename]; iev < nev; ++iev) {
+    auto nev = tin->GetEntries();
+    auto first = std::max(_scan_next[filename], _next_spill[filename]);
+    bool found = false;
+    for (int iev = first; iev < nev && !found; ++iev) {
       tin->GetEntry(iev);
-      
-      /** start of spill **/
-      if (data.is_start_spill()) {
-        has_data = true;
-        if (_verbose) std::cout << " --- start of spill found: event " << iev << std::endl;
-	auto device = data.device;
-	auto fifo = data.fifo;
-	if (!_part_mask.count(device)) _part_mask[device] = 0x0;
-	_part_mask[device] |= (1 << fifo);
-	if (data.coarse_time_clock() == 0xdeadbeef) {
-	  if (!_dead_mask.count(device)) _dead_mask[device] = 0x0;
-	  _dead_mask[device] |= (1 << fifo);
-	}
-      }            
-      
-      /** ALCOR hit **/
-      if (data.is_alcor_hit()) {
-        auto device = data.device;
-        auto chip = data.chip();
-        auto channel = data.eo_channel();
-        auto frame = data.coarse_time_clock() / _frame_size;
-        //        if (_verbose) std::cout << " --- ALCOR hit: device=" << device << " chip=" << chip << " channel=" << channel << " frame=" << frame << std::endl;
-        _frames[frame][device].hits[chip][channel].push_back(data);
-      }
+      _scan_next[filename] = iev + 1;
+      if (type != data::end_spill) continue;
+      _spill_end[filename] = iev;
+      found = true;
+    }
+    fin->Close();
+    
+    if (!found) {
+      if (_verbose) std::cout << " --- spill not complete yet: " << filename << std::endl;
+      return false;
+    }
+    ready = true;
+  }
+  return ready;
+}
+
+/** time-orders the hits of each channel and the triggers of each device **/
+void framer::sort()
+{
+  for (auto &[iframe, aframe] : _frames) {
+    for (auto &[idevice, adevice] : aframe) {
+      data::sort(adevice.triggers);
+      for (auto &[ichip, achip] : adevice.hits)
+        for (auto &[ichannel, hits] : achip)
+          data::sort(hits);
+    }
+  }
+}
+
+bool framer::read_spill(const std::string &filename, pass_t pass)
+{
+  bool has_data = false;
+  
+  /** skip files already known not to belong to this pass **/
+  if (pass != all_devices && _file_device.count(filename) &&
+      is_selection_device(_file_device[filename]) != (pass == selection_devices))
+    return false;
+  
+  /** open file **/
+  if (_verbose) std::cout << " --- opening decoded file: " << filename << std::endl;
+  if (gSystem->AccessPathName(filename.c_str())) {
+    if (_verbose) std::cout << "     file does not exist: " << filename << std::endl;
+    return false;
+  }
+  auto fin = TFile::Open(filename.c_str());
+  if (!fin || !fin->IsOpen()) return false;
+  
+  /** retrieve tree and link it **/
+  auto tin = (TTree *)fin->Get("alcor");
+  auto nev = tin->GetEntries();
+  if (_verbose) std::cout << " --- found " << nev << " entries in tree " << std::endl;
+  sipm4eic::data data;
+  data.link_to_tree(tin);
 
-      /** trigger tag **/
-      if (data.is_trigger_tag()) {
-        auto device = data.device;
-	if (_trigger_coarse_offset.count(device))
-	  data.coarse -= _trigger_coarse_offset[device];
-        auto frame = data.coarse_time_clock() / _frame_size;
-        if (_verbose) std::cout << " --- trigger hit: device=" << device << " frame=" << frame << std::endl;
-        _frames[frame][device].triggers.push_back(data);
+  /** peek at the device of this file **/
+  if (pass != all_devices && !_file_device.count(filename)) {
+    if (_next_spill[filename] >= nev) {
+      fin->Close();
+      return false;
+    }
+    tin->GetEntry(_next_spill[filename]);
+    _file_device[filename] = data.device;
+    if (is_selection_device(data.device) != (pass == selection_devices)) {
+      fin->Close();
+      return false;
+    }
+  }
+  bool accepted_only = pass == other_devices;
+    
+  /** loop over events in tree **/
+  for (int iev = _next_spill[filename]; iev < nev; ++iev) {
+    tin->GetEntry(iev);
+    
+    /** start of spill **/
+    if (data.is_start_spill()) {
+      has_data = true;
+      if (_verbose) std::cout << " --- start of spill found: event " << iev << std::endl;
+      auto device = data.device;
+      auto fifo = data.fifo;
+      if (!_part_mask.count(device)) _part_mask[device] = 0x0;
+      _part_mask[device] |= (1 << fifo);
+      if (data.coarse_time_clock() == 0xdeadbeef) {
+        if (!_dead_mask.count(device)) _dead_mask[device] = 0x0;
+        _dead_mask[device] |= (1 << fifo);
       }
-      
-      /** end of spill **/
-      if (data.is_end_spill()) {
-        if (_verbose) std::cout << " --- end of spill found: event " << iev << std::endl;
-        _next_spill[filename] = iev + 1;
-        break;
+    }            
+    
+    /** ALCOR hit **/
+    if (data.is_alcor_hit()) {
+      auto device = data.device;
+      auto chip = data.chip();
+      auto channel = data.eo_channel();
+      auto frame = data.coarse_time_clock() / _frame_size;
+      //        if (_verbose) std::cout << " --- ALCOR hit: device=" << device << " chip=" << chip << " channel=" << channel << " frame=" << frame << std::endl;
+      auto index = channel_index(device, chip, channel);
+      if (index >= 0) {
+        if (_noisy_rate > 0.) ++_spill_counts[index];
+        if (_masked_bits[index]) continue;
       }
-      
-    } /** end of loop over events in tree **/
+      if (accepted_only && !_frames.count(frame)) continue;
+      if (_calibration) data.update_time_key(*_calibration);
+      else data.update_time_key();
+      _frames[frame][device].hits[chip][channel].push_back(data);
+    }
     
-    fin->Close();
+    /** trigger tag **/
+    if (data.is_trigger_tag()) {
+      auto device = data.device;
+      if (_trigger_coarse_offset.count(device))
+        data.coarse -= _trigger_coarse_offset[device];
+      auto frame = data.coarse_time_clock() / _frame_size;
+      if (_verbose) std::cout << " --- trigger hit: device=" << device << " frame=" << frame << std::endl;
+      if (accepted_only && !_frames.count(frame)) continue;
+      if (_calibration) data.update_time_key(*_calibration);
+      else data.update_time_key();
+      _frames[frame][device].triggers.push_back(data);
+    }
+    
+    /** end of spill **/
+    if (data.is_end_spill()) {
+      if (_verbose) std::cout << " --- end of spill found: event " << iev << std::endl;
+      _next_spill[filename] = iev + 1;
+      break;
+    }
     
-  } /** end of loop over input file list **/
+  } /** end of loop over events in tree **/
   
-  return has_data;
+  fin->Close();
   
+  return has_data;
 }
   
 } /** namespace sipm4eic **/
-
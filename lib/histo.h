@@ -0,0 +1,188 @@
+#pragma once
+
+#include <thread>
+#include <array>
+
+namespace sipm4eic {
+
+/**
+    lightweight dense histograms with fixed uniform binning
+
+    the bin layout, including underflow and overflow bins, is the one of
+    the ROOT histograms. the statistics of the in-range fills are accumulated
+    as in TH1::Fill, hence to_root() exports the same contents, entries,
+    mean and RMS. the per-bin sum of squared weights is not kept, the
+    exported bin errors are those of unweighted fills.
+    they are meant to be filled as per-thread instances and merged at
+    the end with merge(), which sums disjoint bin ranges in parallel
+**/
+
+/** same bin search as TAxis::FindBin for fixed binning **/
+struct histo_axis {
+  int nbins;
+  double min;
+  double max;
+  histo_axis(int n = 0, double lo = 0., double hi = 0.) : nbins(n), min(lo), max(hi) { };
+  int find_bin(double v) const {
+    if (v < min) return 0;
+    if (v >= max) return nbins + 1;
+    return 1 + int(nbins * (v - min) / (max - min));
+  };
+};
+
+template <typename T = float>
+class histo1 {
+
+ public:
+
+  histo1() = default;
+  histo1(int nbins, double min, double max) :
+    _x(nbins, min, max), _counts(nbins + 2, 0) { };
+
+  int find_bin(double x) const { return _x.find_bin(x); };
+
+  void fill(double x, T w = 1) {
+    auto bin = find_bin(x);
+    _counts[bin] += w;
+    ++_entries;
+    if (bin < 1 || bin > _x.nbins) return;
+    _stats[0] += w;
+    _stats[1] += w * w;
+    _stats[2] += w * x;
+    _stats[3] += w * x * x;
+  };
+  void reset() { std::fill(_counts.begin(), _counts.end(), 0); _entries = 0; _stats.fill(0.); };
+
+  T get_bin_content(int bin) const { return _counts[bin]; };
+  std::vector<T> &counts() { return _counts; };
+  long long &entries() { return _entries; };
+  std::array<double, 4> &stats() { return _stats; }; // sumw, sumw2, sumwx, sumwx2
+
+  template <typename R = TH1F> R *to_root(std::string name, std::string title) const;
+
+ private:
+
+  histo_axis _x;
+  std::vector<T> _counts;
+  long long _entries = 0;
+  std::array<double, 4> _stats = {0.};
+
+};
+
+template <typename T>
+template <typename R>
+R *
+histo1<T>::to_root(std::string name, std::string title) const
+{
+  auto h = new R(name.c_str(), title.c_str(), _x.nbins, _x.min, _x.max);
+  for (int bin = 0; bin < _counts.size(); ++bin)
+    if (_counts[bin] != 0) h->SetBinContent(bin, _counts[bin]);
+  auto stats = _stats;
+  h->PutStats(stats.data());
+  h->SetEntries(_entries);
+  return h;
+}
+
+/*******************************************************************************/
+
+template <typename T = float>
+class histo2 {
+
+ public:
+
+  histo2() = default;
+  histo2(int nbinsx, double minx, double maxx, int nbinsy, double miny, double maxy) :
+    _x(nbinsx, minx, maxx), _y(nbinsy, miny, maxy), _counts((nbinsx + 2) * (nbinsy + 2), 0) { };
+
+  int find_bin(double x, double y) const { return _x.find_bin(x) + (_x.nbins + 2) * _y.find_bin(y); };
+
+  void fill(double x, double y, T w = 1) {
+    auto binx = _x.find_bin(x);
+    auto biny = _y.find_bin(y);
+    _counts[binx + (_x.nbins + 2) * biny] += w;
+    ++_entries;
+    if (binx < 1 || binx > _x.nbins || biny < 1 || biny > _y.nbins) return;
+    _stats[0] += w;
+    _stats[1] += w * w;
+    _stats[2] += w * x;
+    _stats[3] += w * x * x;
+    _stats[4] += w * y;
+    _stats[5] += w * y * y;
+    _stats[6] += w * x * y;
+  };
+  void reset() { std::fill(_counts.begin(), _counts.end(), 0); _entries = 0; _stats.fill(0.); };
+
+  T get_bin_content(int binx, int biny) const { return _counts[binx + (_x.nbins + 2) * biny]; };
+  std::vector<T> &counts() { return _counts; };
+  long long &entries() { return _entries; };
+  std::array<double, 7> &stats() { return _stats; }; // sumw, sumw2, sumwx, sumwx2, sumwy, sumwy2, sumwxy
+
+  template <typename R = TH2F> R *to_root(std::string name, std::string title) const;
+
+ private:
+
+  histo_axis _x;
+  histo_axis _y;
+  std::vector<T> _counts;
+  long long _entries = 0;
+  std::array<double, 7> _stats = {0.};
+
+};
+
+template <typename T>
+template <typename R>
+R *
+histo2<T>::to_root(std::string name, std::string title) const
+{
+  auto h = new R(name.c_str(), title.c_str(), _x.nbins, _x.min, _x.max, _y.nbins, _y.min, _y.max);
+  for (int bin = 0; bin < _counts.size(); ++bin)
+    if (_counts[bin] != 0) h->SetBinContent(bin, _counts[bin]);
+  auto stats = _stats;
+  h->PutStats(stats.data());
+  h->SetEntries(_entries);
+  return h;
+}
+
+/*******************************************************************************/
+
+/**
+    sums all histograms into the first one, each thread owns a disjoint
+    range of bins so no locking is needed
+**/
+
+template <typename H>
+void
+merge(std::vector<H> &histos, int nthreads = 1)
+{
+  if (histos.size() < 2) return;
+  auto &target = histos[0].counts();
+  int nbins = target.size();
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads <= 0) nthreads = 1;
+
+  auto sum = [&histos, &target](int first, int last) {
+    for (int i = 1; i < histos.size(); ++i) {
+      auto &source = histos[i].counts();
+      for (int bin = first; bin < last; ++bin)
+        target[bin] += source[bin];
+    }
+  };
+
+  if (nthreads == 1) sum(0, nbins);
+  else {
+    std::vector<std::thread> threads;
+    int chunk = (nbins + nthreads - 1) / nthreads;
+    for (int ithread = 0; ithread < nthreads; ++ithread)
+      threads.emplace_back(sum, ithread * chunk, std::min((ithread + 1) * chunk, nbins));
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  for (int i = 1; i < histos.size(); ++i) {
+    histos[0].entries() += histos[i].entries();
+    for (int j = 0; j < histos[0].stats().size(); ++j)
+      histos[0].stats()[j] += histos[i].stats()[j];
+  }
+}
+
+} /** namespace sipm4eic **/
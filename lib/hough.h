@@ -0,0 +1,298 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <algorithm>
+
+namespace sipm4eic {
+
+/**
+    batched Hough transform for ring finding
+
+    the (x0, y0, r) space is a regular lattice of cell centres, a hit at
+    distance d from the centre (x0, y0) adds a Gaussian weight of (d - r).
+    events are added to a batch with the hits packed in SoA form with
+    per-event offsets, transform() processes the whole batch over threads
+    with one accumulator block per thread and keeps the maximum of each event.
+
+    the accumulator is laid out as [ir][iy][ix], the distances are computed
+    once per hit and centre and the inner loop runs over the contiguous
+    centres, so that it vectorizes across grid cells. the maximum is the
+    first one in the global bin order, as TH3::GetMaximumBin
+
+    the lattice can be adapted to the data with adapt_grid(), which takes the
+    bounds from the maxima of the current batch, and a fine local pass
+    around the maximum of the coarse lattice is enabled with set_fine(),
+    to be called once the coarse lattice is set.
+    the adapted bounds are kept for the following batches, an event whose
+    coarse maximum lands on the edge of the adapted window is flagged and
+    transformed again on the lattice in place before the adaptation
+**/
+
+struct hough_axis {
+  int n = 0;
+  float min = 0.;
+  float stp = 1.;
+  hough_axis(int nbins = 0, float lo = 0., float step = 1.) : n(nbins), min(lo), stp(step) { };
+  float max() const { return min + (n - 1) * stp; };
+  float center(int i) const { return min + i * stp; };
+};
+
+class hough {
+
+public:
+
+  struct maximum_t {
+    float x0 = 0.;
+    float y0 = 0.;
+    float r = 0.;
+    float h = 0.;
+    bool edge = false;
+  };
+
+  hough(int nx, float x_min, float x_stp,
+        int ny, float y_min, float y_stp,
+        int nr, float r_min, float r_stp,
+        float sigma);
+
+  void set_grid(const hough_axis &x, const hough_axis &y, const hough_axis &r);
+  void set_fine(float x_stp, float y_stp, float r_stp);
+  bool adapt_grid(float x_stp, float y_stp, float r_stp, float quantile = 0.005, int pad = 1);
+
+  void clear();
+  int add_event(int n, const float *x, const float *y);
+  void transform(int nthreads = 1);
+
+  const hough_axis &get_x_axis() const { return _xa; };
+  const hough_axis &get_y_axis() const { return _ya; };
+  const hough_axis &get_r_axis() const { return _ra; };
+  int get_cells() const;
+  int get_edges() const;
+
+  int get_batch_size() const { return _offset.size() - 1; };
+  int get_n(int iev) const { return _offset[iev + 1] - _offset[iev]; };
+  const float *get_x(int iev) const { return _x.data() + _offset[iev]; };
+  const float *get_y(int iev) const { return _y.data() + _offset[iev]; };
+  const maximum_t &get_maximum(int iev) const { return _maximum[iev]; };
+
+private:
+
+  maximum_t scan(int iev, const hough_axis &xa, const hough_axis &ya, const hough_axis &ra,
+                 std::vector<float> &acc, std::vector<float> &dist) const;
+  void transform_event(int iev, std::vector<float> &acc, std::vector<float> &dist);
+
+  hough_axis _xa, _ya, _ra;
+  float _k;
+
+  /** lattice before adapt_grid(), for the maxima on the edge of the adapted one **/
+  bool _adapted = false;
+  hough_axis _xfull, _yfull, _rfull;
+
+  /** fine pass window, relative to the coarse maximum **/
+  bool _fine = false;
+  hough_axis _xf, _yf, _rf;
+
+  std::vector<float> _x;
+  std::vector<float> _y;
+  std::vector<int> _offset = {0};
+  std::vector<maximum_t> _maximum;
+
+};
+
+/*******************************************************************************/
+
+hough::hough(int nx, float x_min, float x_stp,
+             int ny, float y_min, float y_stp,
+             int nr, float r_min, float r_stp,
+             float sigma) :
+  _k(-0.5 / (sigma * sigma))
+{
+  set_grid({nx, x_min, x_stp}, {ny, y_min, y_stp}, {nr, r_min, r_stp});
+}
+
+void
+hough::set_grid(const hough_axis &x, const hough_axis &y, const hough_axis &r)
+{
+  _xa = x;
+  _ya = y;
+  _ra = r;
+}
+
+/** the fine window covers one coarse cell on each side of the coarse maximum **/
+void
+hough::set_fine(float x_stp, float y_stp, float r_stp)
+{
+  _fine = x_stp > 0. && y_stp > 0. && r_stp > 0.;
+  if (!_fine) return;
+  auto half = [](float coarse, float fine) { return (int)std::ceil(coarse / fine); };
+  _xf = {2 * half(_xa.stp, x_stp) + 1, -half(_xa.stp, x_stp) * x_stp, x_stp};
+  _yf = {2 * half(_ya.stp, y_stp) + 1, -half(_ya.stp, y_stp) * y_stp, y_stp};
+  _rf = {2 * half(_ra.stp, r_stp) + 1, -half(_ra.stp, r_stp) * r_stp, r_stp};
+}
+
+/**
+    tight lattice from the maxima of the current batch
+    the bounds are the quantile and 1 - quantile of the maxima, extended by pad steps
+**/
+bool
+hough::adapt_grid(float x_stp, float y_stp, float r_stp, float quantile, int pad)
+{
+  if (_maximum.empty()) return false;
+  if (!_adapted) {
+    _xfull = _xa;
+    _yfull = _ya;
+    _rfull = _ra;
+    _adapted = true;
+  }
+  std::vector<float> x0, y0, r;
+  for (auto &m : _maximum) {
+    x0.push_back(m.x0);
+    y0.push_back(m.y0);
+    r.push_back(m.r);
+  }
+  auto axis = [quantile, pad](std::vector<float> &v, float stp) {
+    std::sort(v.begin(), v.end());
+    auto lo = v[(int)(quantile * (v.size() - 1))] - pad * stp;
+    auto hi = v[(int)((1. - quantile) * (v.size() - 1))] + pad * stp;
+    return hough_axis((int)std::ceil((hi - lo) / stp) + 1, lo, stp);
+  };
+  set_grid(axis(x0, x_stp), axis(y0, y_stp), axis(r, r_stp));
+  return true;
+}
+
+/** cells evaluated for each hit **/
+int
+hough::get_cells() const
+{
+  auto cells = _xa.n * _ya.n * _ra.n;
+  if (_fine) cells += _xf.n * _yf.n * _rf.n;
+  return cells;
+}
+
+/** events of the current batch with the coarse maximum on the edge of the adapted lattice **/
+int
+hough::get_edges() const
+{
+  int edges = 0;
+  for (auto &m : _maximum)
+    if (m.edge) ++edges;
+  return edges;
+}
+
+void
+hough::clear()
+{
+  _x.clear();
+  _y.clear();
+  _offset.resize(1);
+  _maximum.clear();
+}
+
+int
+hough::add_event(int n, const float *x, const float *y)
+{
+  _x.insert(_x.end(), x, x + n);
+  _y.insert(_y.end(), y, y + n);
+  _offset.push_back(_x.size());
+  return get_batch_size() - 1;
+}
+
+hough::maximum_t
+hough::scan(int iev, const hough_axis &xa, const hough_axis &ya, const hough_axis &ra,
+            std::vector<float> &acc, std::vector<float> &dist) const
+{
+  const int ncells = xa.n * ya.n;
+  std::fill(acc.begin(), acc.begin() + ncells * ra.n, 0.);
+
+  for (int i = _offset[iev]; i < _offset[iev + 1]; ++i) {
+
+    /** distance of the hit from each centre, independent of r **/
+    float *d = dist.data();
+    for (int iy = 0; iy < ya.n; ++iy) {
+      float dy = ya.center(iy) - _y[i];
+      float dy2 = dy * dy;
+      for (int ix = 0; ix < xa.n; ++ix) {
+        float dx = xa.center(ix) - _x[i];
+        d[iy * xa.n + ix] = std::sqrt(dx * dx + dy2);
+      }
+    }
+
+    /** accumulate over contiguous centres **/
+    for (int ir = 0; ir < ra.n; ++ir) {
+      float r = ra.center(ir);
+      float *h = acc.data() + ir * ncells;
+      for (int ic = 0; ic < ncells; ++ic) {
+        float eta = d[ic] - r;
+        h[ic] += std::exp(_k * eta * eta);
+      }
+    }
+  }
+
+  /** first maximum in global bin order **/
+  int imax = 0;
+  for (int ic = 1; ic < ncells * ra.n; ++ic)
+    if (acc[ic] > acc[imax]) imax = ic;
+  int ix = imax % xa.n, iy = (imax / xa.n) % ya.n, ir = imax / ncells;
+  maximum_t m;
+  m.x0 = xa.center(ix);
+  m.y0 = ya.center(iy);
+  m.r = ra.center(ir);
+  m.h = acc[imax];
+  m.edge = ix == 0 || ix == xa.n - 1 || iy == 0 || iy == ya.n - 1 || ir == 0 || ir == ra.n - 1;
+  return m;
+}
+
+void
+hough::transform_event(int iev, std::vector<float> &acc, std::vector<float> &dist)
+{
+  auto m = scan(iev, _xa, _ya, _ra, acc, dist);
+  bool edge = _adapted && m.edge;
+  if (edge) m = scan(iev, _xfull, _yfull, _rfull, acc, dist);
+  if (_fine) {
+    hough_axis xf(_xf.n, m.x0 + _xf.min, _xf.stp);
+    hough_axis yf(_yf.n, m.y0 + _yf.min, _yf.stp);
+    hough_axis rf(_rf.n, m.r + _rf.min, _rf.stp);
+    m = scan(iev, xf, yf, rf, acc, dist);
+  }
+  m.edge = edge;
+  _maximum[iev] = m;
+}
+
+void
+hough::transform(int nthreads)
+{
+  int nev = get_batch_size();
+  _maximum.assign(nev, maximum_t());
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads <= 0) nthreads = 1;
+  if (nthreads > nev) nthreads = nev > 0 ? nev : 1;
+
+  int nacc = _xa.n * _ya.n * _ra.n;
+  int ndist = _xa.n * _ya.n;
+  if (_adapted) {
+    nacc = std::max(nacc, _xfull.n * _yfull.n * _rfull.n);
+    ndist = std::max(ndist, _xfull.n * _yfull.n);
+  }
+  if (_fine) {
+    nacc = std::max(nacc, _xf.n * _yf.n * _rf.n);
+    ndist = std::max(ndist, _xf.n * _yf.n);
+  }
+
+  std::vector<std::thread> threads;
+  int chunk = (nev + nthreads - 1) / nthreads;
+  for (int ithread = 0; ithread < nthreads; ++ithread) {
+    int first = ithread * chunk;
+    int last = std::min(first + chunk, nev);
+    threads.emplace_back([this, first, last, nacc, ndist]() {
+      std::vector<float> acc(nacc);
+      std::vector<float> dist(ndist);
+      for (int iev = first; iev < last; ++iev)
+        transform_event(iev, acc, dist);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+}
+
+} /** namespace sipm4eic **/
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "lightio.h"
+#include <memory>
+
+namespace sipm4eic {
+
+/** 
+    base class of an analysis fed by lightloop
+    
+    each analysis owns its state and its output file. when the loop runs
+    with several threads, process_frame is called concurrently with
+    different ithread values, hence the state it modifies must be
+    thread-local and merged into the final result in write()
+**/
+  
+class lightana {
+
+ public:
+
+  lightana(std::string name, std::string outfilename) : _name(name), _outfilename(outfilename) { };
+  virtual ~lightana() = default;
+
+  virtual void init(int nthreads) { };
+  virtual void begin_spill(lightio &io) { };
+  virtual void process_frame(lightframe &aframe, int ithread) = 0;
+  virtual void end_spill(lightio &io) { };
+  virtual void write() = 0;
+
+  const std::string &name() const { return _name; };
+  const std::string &outfilename() const { return _outfilename; };
+  
+ protected:
+
+  std::string _name;
+  std::string _outfilename;
+  
+};
+
+/** 
+    single read pass over a lightdata file feeding all registered analyses
+**/
+  
+class lightloop {
+
+ public:
+
+  lightloop() = default;
+  
+  /** the loop takes ownership of the analyses **/
+  void add(lightana *ana) { _analyses.emplace_back(ana); };
+  void run(std::string filename, int nthreads = 1, unsigned int max_spill = kMaxUInt);
+
+ private:
+
+  std::vector<std::unique_ptr<lightana>> _analyses;
+  
+};
+
+void
+lightloop::run(std::string filename, int nthreads, unsigned int max_spill)
+{
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads <= 0) nthreads = 1;
+  
+  sipm4eic::lightio io;
+  io.read_from_tree(filename);
+
+  for (auto &ana : _analyses) {
+    std::cout << " --- init analysis: " << ana->name() << std::endl;
+    ana->init(nthreads);
+  }
+
+  auto process = [this](lightframe &aframe, int ithread) {
+    for (auto &ana : _analyses)
+      ana->process_frame(aframe, ithread);
+  };
+  
+  unsigned int n_spills = 0;
+  for (; n_spills < max_spill && io.next_spill(); ++n_spills) {
+    for (auto &ana : _analyses)
+      ana->begin_spill(io);
+    if (nthreads == 1) io.for_each_frame([&process](lightframe &aframe) { process(aframe, 0); });
+    else io.parallel_for_frames(process, nthreads);
+    for (auto &ana : _analyses)
+      ana->end_spill(io);
+  }
+  std::cout << " --- processed " << n_spills << " spills " << std::endl;
+
+  for (auto &ana : _analyses) {
+    std::cout << " --- writing analysis: " << ana->name() << " --> " << ana->outfilename() << std::endl;
+    ana->write();
+  }
+}
+
+} /** namespace sipm4eic **/
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "calibration.h"
+
 namespace sipm4eic {
 
 class lightdata {
@@ -29,6 +31,13 @@ class lightdata {
   int cindex() const { return tdc + 4 * index; };
   float time() const;
   bool near_cut(float dist = 2) const { return fabs(fine - fine_cut[device - 192][cindex()]) < dist; };
+  float time(const calibration &calib) const;
+  static float time(int coarse, int fine, float iif, float cut, float off) {
+    float corr = (float)fine * iif + off;
+    if (fine >= std::round(cut)) corr -= 1.;
+    return (float)coarse - corr;
+  }
+  bool near_cut(const calibration &calib, float dist = 2) const { return fabs(fine - calib.cut(device - 192, cindex())) < dist; };
 
   /** calibration **/
 
@@ -38,6 +47,7 @@ class lightdata {
   static float fine_cut[16][768];
   static float fine_off[16][768];
   static bool load_fine_calibration(std::string filename);
+  static void set_fine_calibration(const calibration &calib);
   static bool write_fine_calibration(std::string filename);
 
 };
@@ -52,32 +62,38 @@ lightdata::time() const
   auto ci = cindex();
   auto di = device - 192;
   if (di < 0 || di > 15) return (float)coarse;
-  float corr = (float)fine * fine_iif[di][ci] + fine_off[di][ci];
-  if (fine >= std::round(fine_cut[di][ci])) corr -= 1.;
-  auto time = (float)coarse - corr;
-  return time;
+  return time(coarse, fine, fine_iif[di][ci], fine_cut[di][ci], fine_off[di][ci]);
+}
+
+float
+lightdata::time(const calibration &calib) const
+{
+  auto ci = cindex();
+  auto di = device - 192;
+  if (di < 0 || di > 15) return (float)coarse;
+  return time(coarse, fine, calib.iif(di, ci), calib.cut(di, ci), calib.off(di, ci));
 }
 
+/** reads the ROOT tables through calibration, the static tables are a copy **/
 bool
 lightdata::load_fine_calibration(std::string filename)
 {
-  std::cout << " --- loading fine calibration: " << filename << std::endl;
-  auto fin = TFile::Open(filename.c_str());
-  for (int i = 0; i < 16; ++i) {
-    auto device = 192 + i;
-    auto hFine_iif = (TH1 *)fin->Get(Form("hIIF_%d", device));
-    auto hFine_cut = (TH1 *)fin->Get(Form("hCUT_%d", device));
-    auto hFine_off = (TH1 *)fin->Get(Form("hOFF_%d", device));
-    for (int j = 0; j < 768; ++j) {
-      fine_iif[i][j] = hFine_iif ? hFine_iif->GetBinContent(j + 1)  : 0.;
-      fine_cut[i][j] = hFine_cut ? hFine_cut->GetBinContent(j + 1) : 0.;
-      fine_off[i][j] = hFine_off ? hFine_off->GetBinContent(j + 1) : -fine_cut[i][j] * fine_iif[i][j];
-    }
-  }
-  fin->Close();
+  calibration calib;
+  if (!calib.load_lightdata_calibration(filename)) return false;
+  set_fine_calibration(calib);
   return true;
 }
 
+/** copies the tables of a calibration store, either ROOT or binary, to the static tables **/
+void
+lightdata::set_fine_calibration(const calibration &calib)
+{
+  auto &p = calib.payload();
+  std::copy(&p.fine_iif[0][0], &p.fine_iif[0][0] + 16 * 768, &fine_iif[0][0]);
+  std::copy(&p.fine_cut[0][0], &p.fine_cut[0][0] + 16 * 768, &fine_cut[0][0]);
+  std::copy(&p.fine_off[0][0], &p.fine_off[0][0] + 16 * 768, &fine_off[0][0]);
+}
+
 bool
 lightdata::write_fine_calibration(std::string filename)
 {
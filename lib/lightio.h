@@ -1,8 +1,35 @@
 #pragma once
 
 #include "lightdata.h"
+#include <thread>
 
 namespace sipm4eic {
+
+/** 
+    the hits of a single frame, filled by lightio::get_frame
+    it is owned by the caller, hence several frames of the same spill
+    can be decoded at the same time (i.e. one per thread)
+**/
+
+class lightframe {
+
+ public:
+
+  unsigned int index = 0; // position of the frame in the spill
+  unsigned int id = 0;    // frame number
+  std::vector<lightdata> trigger0_vector;
+  std::vector<lightdata> timing_vector;
+  std::vector<lightdata> cherenkov_vector;
+  std::map<std::array<unsigned char, 2>, std::vector<lightdata>> timing_map;
+  std::map<std::array<unsigned char, 2>, std::vector<lightdata>> cherenkov_map;
+
+  std::vector<lightdata> &get_trigger0_vector() { return trigger0_vector; };
+  std::vector<lightdata> &get_timing_vector() { return timing_vector; };
+  std::vector<lightdata> &get_cherenkov_vector() { return cherenkov_vector; };
+  std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &get_timing_map() { return timing_map; };
+  std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &get_cherenkov_map() { return cherenkov_map; };
+  
+};
   
 class lightio {
 
@@ -13,6 +40,7 @@ class lightio {
   static const int max_frames = 65534;   // maximum number of frames in a spill
   static const int max_triggers = 65534; // maximum number of triggers in a spill
   static const int max_hits = 262144;   // maximum number of hits in a spill
+  static const int max_masks = 4096;    // maximum number of masked channels in a spill
 
   unsigned char part_n;
   unsigned char part_device[max_devices];
@@ -21,6 +49,10 @@ class lightio {
   unsigned char dead_n;
   unsigned char dead_device[max_devices];
   unsigned int dead_mask[max_devices];
+  //
+  unsigned short mask_n;               // masked channels in spill
+  unsigned char mask_device[max_masks];
+  unsigned char mask_index[max_masks]; // device index, channel + 32 * chip
   //  
   unsigned short frame_n;         // number of frames
   unsigned int frame[max_frames]; // frame index
@@ -51,6 +83,7 @@ class lightio {
   void new_frame(unsigned int iframe);
   void add_part(unsigned char device, unsigned int mask);
   void add_dead(unsigned char device, unsigned int mask);
+  void add_mask(unsigned char device, unsigned char index);
   void add_trigger0(unsigned char coarse);
   void add_timing(unsigned char device, unsigned char index, unsigned char coarse, unsigned char fine, unsigned char tdc);
   void add_cherenkov(unsigned char device, unsigned char index, unsigned char coarse, unsigned char fine, unsigned char tdc);
@@ -64,6 +97,10 @@ class lightio {
   void read_from_tree(TTree *t);
   bool next_spill();
   bool next_frame();
+  bool frame_at(int iframe);
+  bool get_frame(int iframe, lightframe &aframe) const;
+  template <typename F> void for_each_frame(F &&f, int first = 0, int last = -1) const;
+  template <typename F> void parallel_for_frames(F &&f, int nthreads = 0) const;
   void reset() { spill_current = frame_current = 0; };
 
   
@@ -73,12 +110,17 @@ class lightio {
 
   unsigned int get_current_spill() { return spill_current; };
   unsigned int get_current_frame() { return frame_current; };
+  unsigned int get_frame_n() { return frame_n; };
   unsigned int get_current_frame_id() { return frame[frame_current]; };
   
   std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &get_timing_map() { return timing_map; };
   std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &get_cherenkov_map() { return cherenkov_map; };
 
   TTree *get_tree() { return tree; };
+
+  /** first hit of each frame of the current spill in the spill arrays, frame_n + 1 entries **/
+  const std::vector<unsigned int> &get_timing_offset() const { return timing_offset; };
+  const std::vector<unsigned int> &get_cherenkov_offset() const { return cherenkov_offset; };
   
  private:
 
@@ -88,9 +130,18 @@ class lightio {
   int spill_current = 0;
   int frame_current = 0;
   
-  int trigger0_offset = 0;
-  int timing_offset = 0;
-  int cherenkov_offset = 0;
+  /** prefix sums of the per-frame counts, computed once per spill **/
+  std::vector<unsigned int> trigger0_offset;
+  std::vector<unsigned int> timing_offset;
+  std::vector<unsigned int> cherenkov_offset;
+  void make_offsets();
+  
+  void fill_frame(int iframe,
+                  std::vector<lightdata> &trigger0,
+                  std::vector<lightdata> &timing,
+                  std::vector<lightdata> &cherenkov,
+                  std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &tmap,
+                  std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &cmap) const;
 
   std::vector<lightdata> trigger0_vector;
   std::vector<lightdata> timing_vector;
@@ -107,6 +158,7 @@ lightio::new_spill(unsigned int ispill)
   std::cout << " --- new spill: " << ispill << std::endl;
   part_n = 0;
   dead_n = 0;
+  mask_n = 0;
   frame_n = 0;
   trigger0_size = 0;
   timing_size = 0;
@@ -135,6 +187,14 @@ lightio::add_dead(unsigned char device, unsigned int mask) {
   ++dead_n;
 }
 
+void
+lightio::add_mask(unsigned char device, unsigned char index) {
+  if (mask_n >= max_masks) return;
+  mask_device[mask_n] = device;
+  mask_index[mask_n] = index;
+  ++mask_n;
+}
+
 void
 lightio::add_trigger0(unsigned char coarse) {
   trigger0_coarse[trigger0_size] = coarse;
@@ -207,6 +267,9 @@ lightio::write_to_tree(TTree *t)
   t->Branch("dead_n", &dead_n, "dead_n/b");
   t->Branch("dead_device", &dead_device, "dead_device[dead_n]/b");
   t->Branch("dead_mask", &dead_mask, "dead_mask[dead_n]/i");
+  t->Branch("mask_n", &mask_n, "mask_n/s");
+  t->Branch("mask_device", &mask_device, "mask_device[mask_n]/b");
+  t->Branch("mask_index", &mask_index, "mask_index[mask_n]/b");
   t->Branch("frame_n", &frame_n, "frame_n/s");
   t->Branch("frame", &frame, "frame[frame_n]/i");
   t->Branch("trigger0_size", &trigger0_size, "trigger0_size/i");
@@ -245,6 +308,12 @@ lightio::read_from_tree(TTree *t)
   t->SetBranchAddress("dead_n", &dead_n);
   t->SetBranchAddress("dead_device", &dead_device);
   t->SetBranchAddress("dead_mask", &dead_mask);
+  mask_n = 0;
+  if (t->GetBranch("mask_n")) {
+    t->SetBranchAddress("mask_n", &mask_n);
+    t->SetBranchAddress("mask_device", &mask_device);
+    t->SetBranchAddress("mask_index", &mask_index);
+  }
   t->SetBranchAddress("frame_n", &frame_n);
   t->SetBranchAddress("frame", &frame);
   t->SetBranchAddress("trigger0_size", &trigger0_size);
@@ -274,51 +343,129 @@ lightio::next_spill()
   
   tree->GetEntry(spill_current);
   frame_current = 0;
-  trigger0_offset = 0;
-  timing_offset = 0;
-  cherenkov_offset = 0;
+  make_offsets();
   
   ++spill_current;
   return true;
 }
 
-bool
-lightio::next_frame()
+void
+lightio::make_offsets()
 {
-  if (frame_current >= frame_n)
-    return false;
+  trigger0_offset.resize(frame_n + 1);
+  timing_offset.resize(frame_n + 1);
+  cherenkov_offset.resize(frame_n + 1);
+  trigger0_offset[0] = timing_offset[0] = cherenkov_offset[0] = 0;
+  for (int i = 0; i < frame_n; ++i) {
+    trigger0_offset[i + 1] = trigger0_offset[i] + trigger0_n[i];
+    timing_offset[i + 1] = timing_offset[i] + timing_n[i];
+    cherenkov_offset[i + 1] = cherenkov_offset[i] + cherenkov_n[i];
+  }
+}
 
+void
+lightio::fill_frame(int iframe,
+                    std::vector<lightdata> &trigger0,
+                    std::vector<lightdata> &timing,
+                    std::vector<lightdata> &cherenkov,
+                    std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &tmap,
+                    std::map<std::array<unsigned char, 2>, std::vector<lightdata>> &cmap) const
+{
   // fill trigger0 vector
-  trigger0_vector.clear();
-  for (int i = 0; i < trigger0_n[frame_current]; ++i) {
-    auto ii = trigger0_offset + i;
-    trigger0_vector.push_back(lightdata(0, 0, trigger0_coarse[ii], 0, 0));
-  }
-  trigger0_offset += trigger0_n[frame_current];
+  trigger0.clear();
+  for (auto ii = trigger0_offset[iframe]; ii < trigger0_offset[iframe + 1]; ++ii)
+    trigger0.push_back(lightdata(0, 0, trigger0_coarse[ii], 0, 0));
   
   // fill timing vector and map
-  timing_vector.clear();
-  timing_map.clear();
-  for (int i = 0; i < timing_n[frame_current]; ++i) {
-    auto ii = timing_offset + i;
-    timing_vector.push_back(lightdata(timing_device[ii], timing_index[ii], timing_coarse[ii], timing_fine[ii], timing_tdc[ii]));
-    timing_map[{timing_device[ii], timing_index[ii]}].push_back(lightdata(timing_device[ii], timing_index[ii], timing_coarse[ii], timing_fine[ii], timing_tdc[ii]));
+  timing.clear();
+  tmap.clear();
+  for (auto ii = timing_offset[iframe]; ii < timing_offset[iframe + 1]; ++ii) {
+    lightdata hit(timing_device[ii], timing_index[ii], timing_coarse[ii], timing_fine[ii], timing_tdc[ii]);
+    timing.push_back(hit);
+    tmap[{hit.device, hit.index}].push_back(hit);
   }
-  timing_offset += timing_n[frame_current];
   
   // fill cherenkov vector and map
-  cherenkov_vector.clear();
-  cherenkov_map.clear();
-  for (int i = 0; i < cherenkov_n[frame_current]; ++i) {
-    auto ii = cherenkov_offset + i;
-    cherenkov_vector.push_back(lightdata(cherenkov_device[ii], cherenkov_index[ii], cherenkov_coarse[ii], cherenkov_fine[ii], cherenkov_tdc[ii]));
-    cherenkov_map[{cherenkov_device[ii], cherenkov_index[ii]}].push_back(lightdata(cherenkov_device[ii], cherenkov_index[ii], cherenkov_coarse[ii], cherenkov_fine[ii], cherenkov_tdc[ii]));
+  cherenkov.clear();
+  cmap.clear();
+  for (auto ii = cherenkov_offset[iframe]; ii < cherenkov_offset[iframe + 1]; ++ii) {
+    lightdata hit(cherenkov_device[ii], cherenkov_index[ii], cherenkov_coarse[ii], cherenkov_fine[ii], cherenkov_tdc[ii]);
+    cherenkov.push_back(hit);
+    cmap[{hit.device, hit.index}].push_back(hit);
   }
-  cherenkov_offset += cherenkov_n[frame_current];
+}
 
-  ++frame_current;
+bool
+lightio::next_frame()
+{
+  return frame_at(frame_current);
+}
+
+bool
+lightio::frame_at(int iframe)
+{
+  if (iframe < 0 || iframe >= frame_n)
+    return false;
+
+  fill_frame(iframe, trigger0_vector, timing_vector, cherenkov_vector, timing_map, cherenkov_map);
+  
+  frame_current = iframe + 1;
   return true;
 }
 
-} /** namespace sipm4eic **/
+bool
+lightio::get_frame(int iframe, lightframe &aframe) const
+{
+  if (iframe < 0 || iframe >= frame_n)
+    return false;
 
+  aframe.index = iframe;
+  aframe.id = frame[iframe];
+  fill_frame(iframe, aframe.trigger0_vector, aframe.timing_vector, aframe.cherenkov_vector, aframe.timing_map, aframe.cherenkov_map);
+  return true;
+}
+
+/** 
+    calls f(aframe) for the frames [first, last) of the current spill
+**/
+
+template <typename F>
+void
+lightio::for_each_frame(F &&f, int first, int last) const
+{
+  if (last < 0 || last > frame_n) last = frame_n;
+  lightframe aframe;
+  for (int iframe = first; iframe < last; ++iframe) {
+    get_frame(iframe, aframe);
+    f(aframe);
+  }
+}
+
+/** 
+    splits the frames of the current spill in contiguous ranges, one per thread,
+    and calls f(aframe, ithread) for each of them. f must only write to
+    thread-local outputs indexed by ithread, to be merged by the caller
+**/
+
+template <typename F>
+void
+lightio::parallel_for_frames(F &&f, int nthreads) const
+{
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads <= 0) nthreads = 1;
+  if (nthreads > frame_n) nthreads = frame_n > 0 ? frame_n : 1;
+  
+  std::vector<std::thread> threads;
+  int chunk = (frame_n + nthreads - 1) / nthreads;
+  for (int ithread = 0; ithread < nthreads; ++ithread) {
+    int first = ithread * chunk;
+    int last = std::min(first + chunk, (int)frame_n);
+    threads.emplace_back([this, &f, first, last, ithread]() {
+      for_each_frame([&f, ithread](lightframe &aframe) { f(aframe, ithread); }, first, last);
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+}
+
+} /** namespace sipm4eic **/
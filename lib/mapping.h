@@ -160,4 +160,26 @@ get_position(std::array<int, 3> geo)
   return {x, y};
 }
 
+/*******************************************************************************/
+
+/** 
+    global pixel identifier, 16x16 SiPMs on each of the 8 PDUs
+
+    id = (pdu - 1) * 256 + col * 16 + row = [0, 2047]
+**/
+
+const int max_pixel_id = 2048;
+
+int
+get_pixel_id(std::array<int, 3> geo)
+{
+  return (geo[0] - 1) * 256 + geo[1] * 16 + geo[2];
+}
+
+std::array<int, 3>
+get_geo_from_pixel_id(int id)
+{
+  return {id / 256 + 1, (id / 16) % 16, id % 16};
+}
+
 }
@@ -0,0 +1,153 @@
+#pragma once
+
+namespace sipm4eic {
+
+/**
+    reader of recodata trees, in either layout
+
+    - float layout: x[n], y[n], t[n] per event
+    - compact layout: id[n] global pixel id and dt[n] integer time per event,
+      the pixel centres and the time unit are stored once in the "geometry" tree
+
+    x/y/t are expanded on demand for the compact layout, pixel-indexed
+    algorithms can use get_id() directly
+**/
+
+class recoio {
+
+ public:
+
+  static const int max_hits = 65534;
+  static const int max_pixels = 2048;
+
+  recoio() = default;
+
+  bool read_from_tree(std::string filename, std::string treename = "recodata");
+  void close() { if (file) file->Close(); file = nullptr; tree = nullptr; };
+  Long64_t get_entries() { return tree ? tree->GetEntries() : 0; };
+  bool get_entry(Long64_t iev);
+
+  bool is_compact() const { return compact; };
+  unsigned short get_n() const { return n; };
+  const unsigned short *get_id() const { return compact ? id : nullptr; };
+  const float *get_x();
+  const float *get_y();
+  const float *get_t();
+
+  float pixel_x(int pixel) const { return geo_x[pixel]; };
+  float pixel_y(int pixel) const { return geo_y[pixel]; };
+  float get_t_lsb() const { return t_lsb; };
+
+ private:
+
+  TFile *file = nullptr;
+  TTree *tree = nullptr;
+  bool compact = false;
+  bool expanded = false;
+
+  unsigned short n = 0;
+  unsigned short id[max_hits];
+  signed char dt[max_hits];
+  float x[max_hits];
+  float y[max_hits];
+  float t[max_hits];
+
+  float geo_x[max_pixels] = {0.};
+  float geo_y[max_pixels] = {0.};
+  float t_lsb = 1.;
+
+  void expand();
+
+};
+
+bool
+recoio::read_from_tree(std::string filename, std::string treename)
+{
+  file = TFile::Open(filename.c_str());
+  if (!file || !file->IsOpen()) return false;
+  tree = (TTree *)file->Get(treename.c_str());
+  if (!tree) return false;
+  compact = tree->GetBranch("id") != nullptr;
+  expanded = !compact;
+  tree->SetBranchAddress("n", &n);
+  if (!compact) {
+    tree->SetBranchAddress("x", &x);
+    tree->SetBranchAddress("y", &y);
+    tree->SetBranchAddress("t", &t);
+    return true;
+  }
+
+  tree->SetBranchAddress("id", &id);
+  tree->SetBranchAddress("dt", &dt);
+
+  /** load the geometry table once **/
+  auto tgeo = (TTree *)file->Get("geometry");
+  if (!tgeo) return false;
+  unsigned short geo_n;
+  tgeo->SetBranchAddress("n", &geo_n);
+  tgeo->SetBranchAddress("x", &geo_x);
+  tgeo->SetBranchAddress("y", &geo_y);
+  tgeo->SetBranchAddress("t_lsb", &t_lsb);
+  tgeo->GetEntry(0);
+  return true;
+}
+
+bool
+recoio::get_entry(Long64_t iev)
+{
+  if (!tree || iev >= tree->GetEntries()) return false;
+  tree->GetEntry(iev);
+  expanded = !compact;
+  if (!compact) return true;
+  /** drop hits with a pixel id outside the geometry table **/
+  int m = 0;
+  for (int i = 0; i < n; ++i) {
+    if (id[i] >= max_pixels) continue;
+    id[m] = id[i];
+    dt[m] = dt[i];
+    ++m;
+  }
+  if (m != n) {
+    std::cout << " --- WARNING: dropped " << n - m << " hits with pixel id beyond " << max_pixels << " in event " << iev << std::endl;
+    n = m;
+  }
+  return true;
+}
+
+void
+recoio::expand()
+{
+  for (int i = 0; i < n; ++i) {
+    if (id[i] >= max_pixels) {
+      x[i] = y[i] = t[i] = 0.;
+      continue;
+    }
+    x[i] = geo_x[id[i]];
+    y[i] = geo_y[id[i]];
+    t[i] = dt[i] * t_lsb;
+  }
+  expanded = true;
+}
+
+const float *
+recoio::get_x()
+{
+  if (!expanded) expand();
+  return x;
+}
+
+const float *
+recoio::get_y()
+{
+  if (!expanded) expand();
+  return y;
+}
+
+const float *
+recoio::get_t()
+{
+  if (!expanded) expand();
+  return t;
+}
+
+} /** namespace sipm4eic **/
@@ -0,0 +1,145 @@
+#pragma once
+
+#include "lightio.h"
+#include "calibration.h"
+
+namespace sipm4eic {
+
+/**
+    frame-level reference time and time deltas for the fine time refinement
+
+    for each frame the earliest time of each timing channel (keyed by index)
+    is kept in a generation-stamped table, the reference time is their mean
+    and for device 207 hits of a channel in the table the reference excludes
+    that channel. the times are computed once per hit.
+    the deltas {device, cindex, fine, delta} of all timing and cherenkov hits
+    are appended to a reusable buffer, add_frames() processes a range of
+    frames of the current spill directly from the lightio arrays.
+    delta is (coarse - reference), or (time - reference) when correct is set
+**/
+
+class refine {
+
+public:
+
+  struct delta_t {
+    unsigned char device;
+    unsigned char fine;
+    unsigned short cindex;
+    double delta;
+  };
+
+  refine(const calibration &calib, bool correct = false) : _calib(calib), _correct(correct) { };
+
+  void clear() { _deltas.clear(); };
+  void add_frame(const std::vector<lightdata> &timing, const std::vector<lightdata> &cherenkov);
+  void add_frame(const lightframe &aframe) { add_frame(aframe.timing_vector, aframe.cherenkov_vector); };
+  void add_frames(const lightio &io, int first = 0, int last = -1);
+
+  const std::vector<delta_t> &get_deltas() const { return _deltas; };
+
+private:
+
+  template <typename T, typename C> void process(int ntiming, T &&timing, int ncherenkov, C &&cherenkov);
+  void emit(const lightdata &hit, float time, float Tref, int Nref);
+
+  const calibration &_calib;
+  bool _correct;
+
+  unsigned int _generation = 0;
+  unsigned int _stamp[256] = {0};
+  float _earliest[256];
+  std::vector<unsigned char> _touched;
+  std::vector<float> _timing_time;
+
+  std::vector<delta_t> _deltas;
+
+};
+
+/*******************************************************************************/
+
+/** timing(i) and cherenkov(i) return the i-th hit of the frame **/
+template <typename T, typename C>
+void
+refine::process(int ntiming, T &&timing, int ncherenkov, C &&cherenkov)
+{
+  if (++_generation == 0) {
+    std::fill(_stamp, _stamp + 256, 0);
+    _generation = 1;
+  }
+
+  /** earliest time per timing channel **/
+  _touched.clear();
+  _timing_time.resize(ntiming);
+  for (int i = 0; i < ntiming; ++i) {
+    auto hit = timing(i);
+    auto time = hit.time(_calib);
+    _timing_time[i] = time;
+    auto index = hit.index;
+    if (_stamp[index] != _generation) {
+      _stamp[index] = _generation;
+      _earliest[index] = time;
+      _touched.push_back(index);
+    }
+    else if (!(_earliest[index] < time))
+      _earliest[index] = time;
+  }
+
+  /** mean reference time, summed in channel order **/
+  std::sort(_touched.begin(), _touched.end());
+  int Nref = _touched.size();
+  float Tref = 0.;
+  for (auto index : _touched)
+    Tref += _earliest[index];
+  Tref /= Nref;
+
+  /** deltas **/
+  for (int i = 0; i < ntiming; ++i)
+    emit(timing(i), _timing_time[i], Tref, Nref);
+  for (int i = 0; i < ncherenkov; ++i) {
+    auto hit = cherenkov(i);
+    emit(hit, _correct ? hit.time(_calib) : 0., Tref, Nref);
+  }
+}
+
+void
+refine::emit(const lightdata &hit, float time, float Tref, int Nref)
+{
+  auto T = Tref;
+
+  /** reference time excluding this channel if included in timing **/
+  if (hit.device == 207 && _stamp[hit.index] == _generation)
+    T = (Tref * Nref - _earliest[hit.index]) / (Nref - 1);
+
+  double delta = _correct ? time - T : hit.coarse - T;
+  _deltas.push_back({hit.device, hit.fine, (unsigned short)hit.cindex(), delta});
+}
+
+void
+refine::add_frame(const std::vector<lightdata> &timing, const std::vector<lightdata> &cherenkov)
+{
+  process(timing.size(), [&timing](int i) -> const lightdata & { return timing[i]; },
+          cherenkov.size(), [&cherenkov](int i) -> const lightdata & { return cherenkov[i]; });
+}
+
+void
+refine::add_frames(const lightio &io, int first, int last)
+{
+  if (last < 0 || last > io.frame_n) last = io.frame_n;
+  auto &toffset = io.get_timing_offset();
+  auto &coffset = io.get_cherenkov_offset();
+  for (int iframe = first; iframe < last; ++iframe) {
+    auto t0 = toffset[iframe];
+    auto c0 = coffset[iframe];
+    process(toffset[iframe + 1] - t0, [&io, t0](int i) {
+              auto ii = t0 + i;
+              return lightdata(io.timing_device[ii], io.timing_index[ii], io.timing_coarse[ii], io.timing_fine[ii], io.timing_tdc[ii]);
+            },
+            coffset[iframe + 1] - c0, [&io, c0](int i) {
+              auto ii = c0 + i;
+              return lightdata(io.cherenkov_device[ii], io.cherenkov_index[ii], io.cherenkov_coarse[ii], io.cherenkov_fine[ii], io.cherenkov_tdc[ii]);
+            });
+  }
+}
+
+} /** namespace sipm4eic **/
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "framer.h"
+
+namespace sipm4eic {
+
+/**
+    run layout and frame selection shared by the offline (lightwriter)
+    and online (lightmonitor) processing, so that they cannot drift apart
+**/
+
+const std::vector<std::string> devices = {
+  "kc705-192",
+  "kc705-193",
+  "kc705-194",
+  "kc705-195",
+  "kc705-196",
+  "kc705-197",
+  "kc705-198",
+  "kc705-207"
+};
+
+/** devices read by select_frame(), see framer::set_frame_selection **/
+const std::vector<int> selection_devices = {192, 207};
+
+/** selection on Luca's trigger (device 192) and on timing scintillators (device 207) **/
+bool
+select_frame(int iframe, framer::frame_t &aframe)
+{
+  auto trigger = aframe.find(192);
+  if (trigger == aframe.end() || trigger->second.triggers.size() != 1) return false;
+  auto timing = aframe.find(207);
+  if (timing == aframe.end()) return false;
+  auto &hits = timing->second.hits;
+  if (!hits.count(4) && !hits.count(5)) return false;
+  return true;
+}
+
+} /** namespace sipm4eic **/
@@ -38,19 +38,26 @@ float *gpu_h = nullptr;
 float *gpu_rh = nullptr;
 int *gpu_rhi = nullptr;
 
+/** batch buffers, grown on demand **/
+float *gpu_bx = nullptr;
+float *gpu_by = nullptr;
+int *gpu_boffset = nullptr;
+float *gpu_brh = nullptr;
+int *gpu_brhi = nullptr;
+float *gpu_bmax = nullptr;
+int *gpu_bimax = nullptr;
+int gpu_bhits = 0;
+int gpu_bevents = 0;
+
 float *gpu_xmap = nullptr;
 float *gpu_ymap = nullptr;
 float *gpu_rmap = nullptr;
 
-const float x_min = -15.5;
-const float x_stp = 1.;
-const float y_min = -15.5;
-const float y_stp = 1.;
-const float r_min = 32.;
-const float r_stp = 1.;
+/** the lattice origin and spacing are set at init, the default was (-15.5, -15.5, 32) with unit steps **/
 
 __global__ void
-hough_gpu_init(float *xmap, float *ymap, float *rmap, int Nx, int Ny, int Nr) {
+hough_gpu_init(float *xmap, float *ymap, float *rmap, int Nx, int Ny, int Nr,
+	       float x_min, float x_stp, float y_min, float y_stp, float r_min, float r_stp) {
 
   int tid = blockIdx.x * blockDim.x + threadIdx.x;
 
@@ -128,8 +135,115 @@ find_max_kernel(float *h, float *rh, int *rhi)
 
 }
 
+/**
+    batched transform: blockIdx.y is the event in the batch
+    the hits of the event are staged in shared memory and each thread
+    accumulates its cell in a register, the block maximum is reduced
+    directly without storing the Hough space
+**/
+
+__global__ void
+hough_gpu_transform_batch(float *xmap, float *ymap, float *rmap, float *x, float *y, int *offset, float *rh, int *rhi)
+{
+  __shared__ float shx[256];
+  __shared__ float shy[256];
+  __shared__ float shm[256];
+  __shared__ int shmi[256];
+
+  int tid = threadIdx.x;
+  int gid = blockIdx.x * blockDim.x + threadIdx.x;
+  int iev = blockIdx.y;
+  int first = offset[iev];
+  int last = offset[iev + 1];
+
+  float cx = xmap[gid];
+  float cy = ymap[gid];
+  float cr = rmap[gid];
+
+  float h = 0.;
+  for (int chunk = first; chunk < last; chunk += blockDim.x) {
+    __syncthreads();
+    if (chunk + tid < last) {
+      shx[tid] = x[chunk + tid];
+      shy[tid] = y[chunk + tid];
+    }
+    __syncthreads();
+    int n = min((int)blockDim.x, last - chunk);
+    for (int i = 0; i < n; ++i) {
+      float dx = cx - shx[i];
+      float dy = cy - shy[i];
+      float dr = hypotf(dx, dy) - cr;
+      h += 0.11398351 * expf(-0.040816327 * dr * dr);
+    }
+  }
+
+  shm[tid] = h;
+  shmi[tid] = gid;
+  __syncthreads();
+
+  for (int stride = blockDim.x / 2; stride > 0; stride >>= 1) {
+    if (tid < stride) {
+      if (shm[tid + stride] > shm[tid]) {
+	shm[tid] = shm[tid + stride];
+	shmi[tid] = shmi[tid + stride];
+      }
+    }
+    __syncthreads();
+  }
+
+  if (tid == 0) {
+    rh[iev * gridDim.x + blockIdx.x] = shm[0];
+    rhi[iev * gridDim.x + blockIdx.x] = shmi[0];
+  }
+
+}
+
+/** one block per event reduces the block maxima to the event maximum **/
+__global__ void
+find_max_batch_kernel(float *rh, int *rhi, float *hmax, int *himax, int Nrh)
+{
+  __shared__ float shm[256];
+  __shared__ int shmi[256];
+
+  int tid = threadIdx.x;
+  int iev = blockIdx.x;
+  float *erh = rh + iev * Nrh;
+  int *erhi = rhi + iev * Nrh;
+
+  /** keep the first maximum, as the per-event search on the host **/
+  shm[tid] = -1.;
+  shmi[tid] = 0;
+  int imax = -1;
+  for (int i = tid; i < Nrh; i += blockDim.x) {
+    if (erh[i] > shm[tid]) {
+      shm[tid] = erh[i];
+      imax = i;
+    }
+  }
+  shmi[tid] = imax < 0 ? Nrh : imax;
+  __syncthreads();
+
+  for (int stride = blockDim.x / 2; stride > 0; stride >>= 1) {
+    if (tid < stride) {
+      if (shm[tid + stride] > shm[tid] ||
+	  (shm[tid + stride] == shm[tid] && shmi[tid + stride] < shmi[tid])) {
+	shm[tid] = shm[tid + stride];
+	shmi[tid] = shmi[tid + stride];
+      }
+    }
+    __syncthreads();
+  }
+
+  if (tid == 0) {
+    hmax[iev] = shm[0];
+    himax[iev] = erhi[shmi[0]];
+  }
+
+}
+
 void
-hough_init(float *cpu_xmap, float *cpu_ymap, float *cpu_rmap, int Nx, int Ny, int Nr)
+hough_init(float *cpu_xmap, float *cpu_ymap, float *cpu_rmap, int Nx, int Ny, int Nr,
+	   float x_min, float x_stp, float y_min, float y_stp, float r_min, float r_stp)
 {
   int Nh = 256 * Nx * Ny * Nr;
   
@@ -147,7 +261,7 @@ hough_init(float *cpu_xmap, float *cpu_ymap, float *cpu_rmap, int Nx, int Ny, in
   // launch kernel
   dim3 block_size(256, 1, 1);
   dim3 grid_size(Nx * Ny * Nr, 1, 1);
-  hough_gpu_init<<<grid_size, block_size>>>(gpu_xmap, gpu_ymap, gpu_rmap, Nx, Ny, Nr);
+  hough_gpu_init<<<grid_size, block_size>>>(gpu_xmap, gpu_ymap, gpu_rmap, Nx, Ny, Nr, x_min, x_stp, y_min, y_stp, r_min, r_stp);
 
   // copy data from device
   HANDLE_ERROR( cudaMemcpy(cpu_xmap, gpu_xmap, Nh * sizeof(float), cudaMemcpyDeviceToHost) );
@@ -166,6 +280,15 @@ hough_free()
   cudaFree(gpu_rh);
   cudaFree(gpu_rhi);
   
+  cudaFree(gpu_bx);
+  cudaFree(gpu_by);
+  cudaFree(gpu_boffset);
+  cudaFree(gpu_brh);
+  cudaFree(gpu_brhi);
+  cudaFree(gpu_bmax);
+  cudaFree(gpu_bimax);
+  gpu_bhits = gpu_bevents = 0;
+  
   cudaFree(gpu_xmap);
   cudaFree(gpu_ymap);
   cudaFree(gpu_rmap);
@@ -191,3 +314,58 @@ hough_transform(float *cpu_x, float *cpu_y, float *cpu_rh, int *cpu_rhi, int cpu
   HANDLE_ERROR( cudaMemcpy(cpu_rhi, gpu_rhi, Nrh * sizeof(int), cudaMemcpyDeviceToHost) );
 }
 
+
+void
+hough_batch_reserve(int cpu_nhits, int cpu_nevents, int Nrh)
+{
+  if (cpu_nhits > gpu_bhits) {
+    cudaFree(gpu_bx);
+    cudaFree(gpu_by);
+    HANDLE_ERROR( cudaMalloc((void **)&gpu_bx, cpu_nhits * sizeof(float)) );
+    HANDLE_ERROR( cudaMalloc((void **)&gpu_by, cpu_nhits * sizeof(float)) );
+    gpu_bhits = cpu_nhits;
+  }
+  if (cpu_nevents > gpu_bevents) {
+    cudaFree(gpu_boffset);
+    cudaFree(gpu_brh);
+    cudaFree(gpu_brhi);
+    cudaFree(gpu_bmax);
+    cudaFree(gpu_bimax);
+    HANDLE_ERROR( cudaMalloc((void **)&gpu_boffset, (cpu_nevents + 1) * sizeof(int)) );
+    HANDLE_ERROR( cudaMalloc((void **)&gpu_brh, cpu_nevents * Nrh * sizeof(float)) );
+    HANDLE_ERROR( cudaMalloc((void **)&gpu_brhi, cpu_nevents * Nrh * sizeof(int)) );
+    HANDLE_ERROR( cudaMalloc((void **)&gpu_bmax, cpu_nevents * sizeof(float)) );
+    HANDLE_ERROR( cudaMalloc((void **)&gpu_bimax, cpu_nevents * sizeof(int)) );
+    gpu_bevents = cpu_nevents;
+  }
+}
+
+/**
+    transform a batch of events at once
+    the hits are packed in SoA form, the hits of event i are [offset[i], offset[i + 1])
+    returns the maximum and the index of its cell in the maps for each event.
+    one copy in, one launch pair and one copy out per batch, the batch size
+    is limited to 65535 events by the grid y dimension
+**/
+void
+hough_transform_batch(float *cpu_x, float *cpu_y, int *cpu_offset, int cpu_nevents, float *cpu_max, int *cpu_imax, int Nx, int Ny, int Nr)
+{
+  int Nrh = Nx * Ny * Nr;
+  int nhits = cpu_offset[cpu_nevents];
+  hough_batch_reserve(nhits > 0 ? nhits : 1, cpu_nevents, Nrh);
+
+  // copy data to device
+  HANDLE_ERROR( cudaMemcpy(gpu_bx, cpu_x, nhits * sizeof(float), cudaMemcpyHostToDevice) );
+  HANDLE_ERROR( cudaMemcpy(gpu_by, cpu_y, nhits * sizeof(float), cudaMemcpyHostToDevice) );
+  HANDLE_ERROR( cudaMemcpy(gpu_boffset, cpu_offset, (cpu_nevents + 1) * sizeof(int), cudaMemcpyHostToDevice) );
+
+  // launch kernels
+  dim3 block_size(256, 1, 1);
+  dim3 grid_size(Nrh, cpu_nevents, 1);
+  hough_gpu_transform_batch<<<grid_size, block_size>>>(gpu_xmap, gpu_ymap, gpu_rmap, gpu_bx, gpu_by, gpu_boffset, gpu_brh, gpu_brhi);
+  find_max_batch_kernel<<<cpu_nevents, block_size>>>(gpu_brh, gpu_brhi, gpu_bmax, gpu_bimax, Nrh);
+
+  // copy data from device
+  HANDLE_ERROR( cudaMemcpy(cpu_max, gpu_bmax, cpu_nevents * sizeof(float), cudaMemcpyDeviceToHost) );
+  HANDLE_ERROR( cudaMemcpy(cpu_imax, gpu_bimax, cpu_nevents * sizeof(int), cudaMemcpyDeviceToHost) );
+}
@@ -1,15 +1,25 @@
 #include <boost/program_options.hpp>
 #include <iostream>
 #include <algorithm>
+#include <vector>
+#include <chrono>
 #include "TFile.h"
 #include "TTree.h"
+#include "../../../lib/recoio.h"
+#include "../../../lib/hough.h"
 
-extern void hough_init(float *cpu_xmap, float *cpu_ymap, float *cpu_rmap, int Nx, int Ny, int Nr);
+extern void hough_init(float *cpu_xmap, float *cpu_ymap, float *cpu_rmap, int Nx, int Ny, int Nr,
+                       float x_min, float x_stp, float y_min, float y_stp, float r_min, float r_stp);
 extern void hough_transform(float *cpu_x, float *cpu_y, float *cpu_rh, int *cpu_rhi, int cpu_n, int Nx, int Ny, int Nr);
+extern void hough_transform_batch(float *cpu_x, float *cpu_y, int *cpu_offset, int cpu_nevents, float *cpu_max, int *cpu_imax, int Nx, int Ny, int Nr);
 extern void hough_free();
 
 struct program_options_t {
   std::string recodata, ringdata;
+  int batch;
+  int nx, ny, nr;
+  float x_min, y_min, r_min, step;
+  bool adaptive;
 };
 
 void
@@ -23,6 +33,15 @@ process_program_options(int argc, char *argv[], program_options_t &opt)
       ("help"             , "Print help messages")
       ("recodata"         , po::value<std::string>(&opt.recodata)->required(), "Reconstructed data input filename")
       ("ringdata"         , po::value<std::string>(&opt.ringdata)->required(), "Ring data output filename")
+      ("batch"            , po::value<int>(&opt.batch)->default_value(1024), "Number of events transformed at once")
+      ("nx"               , po::value<int>(&opt.nx)->default_value(4), "Number of 8-cell blocks along x")
+      ("ny"               , po::value<int>(&opt.ny)->default_value(4), "Number of 8-cell blocks along y")
+      ("nr"               , po::value<int>(&opt.nr)->default_value(16), "Number of 4-cell blocks along r")
+      ("xmin"             , po::value<float>(&opt.x_min)->default_value(-15.5), "Centre of the first cell along x [mm]")
+      ("ymin"             , po::value<float>(&opt.y_min)->default_value(-15.5), "Centre of the first cell along y [mm]")
+      ("rmin"             , po::value<float>(&opt.r_min)->default_value(32.), "Centre of the first cell along r [mm]")
+      ("step"             , po::value<float>(&opt.step)->default_value(1.), "Cell spacing [mm]")
+      ("adaptive"         , po::bool_switch(&opt.adaptive), "Set the lattice bounds from a first-pass sample of events")
       ;
     
     po::variables_map vm;
@@ -48,18 +67,13 @@ main(int argc, char *argv[])
   program_options_t opt;
   process_program_options(argc, argv, opt);
 
-  /** link to input reconstructed data tree **/
-  unsigned short n;
-  float x[65534];
-  float y[65534];
-  float t[65534];
-  auto fin = TFile::Open(opt.recodata.c_str());
-  auto tin = (TTree *)fin->Get("recodata");
-  auto nev = tin->GetEntries();
-  tin->SetBranchAddress("n", &n);
-  tin->SetBranchAddress("x", &x);
-  tin->SetBranchAddress("y", &y);
-  tin->SetBranchAddress("t", &t);
+  /** link to input reconstructed data tree, float or compact layout **/
+  auto io = new sipm4eic::recoio;
+  if (!io->read_from_tree(opt.recodata)) {
+    std::cerr << "Error: cannot read recodata: " << opt.recodata << std::endl;
+    exit(1);
+  }
+  auto nev = io->get_entries();
 
   /** create output ring data tree **/
   auto fout = TFile::Open(opt.ringdata.c_str(), "RECREATE");
@@ -72,48 +86,126 @@ main(int argc, char *argv[])
   tout->Branch("X0", &X0, "X0[N]/F");
   tout->Branch("Y0", &Y0, "Y0[N]/F");
   tout->Branch("R", &R, "R[N]/F");
+  /** processing time per event, the batch time is shared among its events **/
+  float us;
+  tout->Branch("us", &us, "us/F");
+
+  /**
+      adaptive lattice from the maxima of the first batch on the CPU, with the full lattice of hough.C,
+      padded by two steps. events with the maximum on the edge of the device lattice are transformed
+      again on the CPU with the full lattice
+  **/
+  int batch = std::max(1, std::min(opt.batch, 65535));
+  sipm4eic::hough full(31, -30., 2., 31, -30., 2., 26, 40., 2., 3.5);
+  if (opt.adaptive) {
+    sipm4eic::hough sample(31, -30., 2., 31, -30., 2., 26, 40., 2., 3.5);
+    for (int iev = 0; iev < nev && iev < batch; ++iev) {
+      io->get_entry(iev);
+      sample.add_event(io->get_n(), io->get_x(), io->get_y());
+    }
+    sample.transform(0);
+    sample.adapt_grid(opt.step, opt.step, opt.step, 0.005, 2);
+    auto &xa = sample.get_x_axis();
+    auto &ya = sample.get_y_axis();
+    auto &ra = sample.get_r_axis();
+    opt.x_min = xa.min;
+    opt.y_min = ya.min;
+    opt.r_min = ra.min;
+    opt.nx = (xa.n + 7) / 8;
+    opt.ny = (ya.n + 7) / 8;
+    opt.nr = (ra.n + 3) / 4;
+    std::cout << " --- adaptive grid: x [" << xa.min << ", " << xa.max() << "] y [" << ya.min << ", " << ya.max()
+              << "] r [" << ra.min << ", " << ra.max() << "] mm: " << opt.nx << "x" << opt.ny << "x" << opt.nr << " blocks " << std::endl;
+  }
 
   /** initialise device **/
-  const int Nx = 4;
-  const int Ny = 4;
-  const int Nr = 16;
+  const int Nx = opt.nx;
+  const int Ny = opt.ny;
+  const int Nr = opt.nr;
   const int Nh = 256 * Nx * Ny * Nr;
-  const int Nrh = Nx * Ny * Nr;
   auto xmap = new float[Nh];
   auto ymap = new float[Nh];
   auto rmap = new float [Nh];
-  hough_init(xmap, ymap, rmap, Nx, Ny, Nr);
+  hough_init(xmap, ymap, rmap, Nx, Ny, Nr, opt.x_min, opt.step, opt.y_min, opt.step, opt.r_min, opt.step);
 
-  /** loop over events **/
-  auto hough = new float[Nh];
-  auto rhough = new float[Nrh];
-  auto rhoughi = new int[Nrh];
-  for (int iev = 0; iev < nev; ++iev) {
-    tin->GetEntry(iev);
+  /** loop over batches of events **/
+  std::vector<float> bx, by;
+  std::vector<int> boffset;
+  std::vector<float> bmax(batch);
+  std::vector<int> bimax(batch);
+  std::vector<int> bedge;
+  int n_edges = 0;
+  auto on_edge = [&opt](float value, float min, int n) {
+    return value < min + 0.5 * opt.step || value > min + (n - 1.5) * opt.step;
+  };
+  for (int fev = 0; fev < nev; fev += batch) {
+    int bnev = std::min((Long64_t)batch, nev - fev);
+
+    /** pack the hits of the batch **/
+    auto start = std::chrono::steady_clock::now();
+    bx.clear();
+    by.clear();
+    boffset.assign(1, 0);
+    for (int iev = fev; iev < fev + bnev; ++iev) {
+      io->get_entry(iev);
+      auto n = io->get_n();
+      auto x = io->get_x();
+      auto y = io->get_y();
+      bx.insert(bx.end(), x, x + n);
+      by.insert(by.end(), y, y + n);
+      boffset.push_back(bx.size());
+    }
 
-    /** reset ring data **/
-    N = 0;
-    
     /** hough transform **/
-    hough_transform(x, y, rhough, rhoughi, n, Nx, Ny, Nr);
-
-    /** get maximum **/
-    int rimax = std::distance(rhough, std::max_element(rhough, rhough + Nrh));
-    int imax = rhoughi[rimax];
-    X0[N] = xmap[imax];
-    Y0[N] = ymap[imax];
-    R[N] = rmap[imax];
-
-    /** fill tree with ring data **/
-    ++N;
-    tout->Fill();
+    hough_transform_batch(bx.data(), by.data(), boffset.data(), bnev, bmax.data(), bimax.data(), Nx, Ny, Nr);
+
+    /** maxima on the edge of the adapted lattice **/
+    bedge.clear();
+    if (opt.adaptive) {
+      full.clear();
+      for (int bev = 0; bev < bnev; ++bev) {
+        int imax = bimax[bev];
+        if (!on_edge(xmap[imax], opt.x_min, 8 * Nx) && !on_edge(ymap[imax], opt.y_min, 8 * Ny) && !on_edge(rmap[imax], opt.r_min, 4 * Nr)) continue;
+        bedge.push_back(bev);
+        full.add_event(boffset[bev + 1] - boffset[bev], bx.data() + boffset[bev], by.data() + boffset[bev]);
+      }
+      if (!bedge.empty()) full.transform(0);
+      n_edges += bedge.size();
+    }
+    std::chrono::duration<float, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+    us = elapsed.count() / bnev;
+
+    for (int bev = 0; bev < bnev; ++bev) {
+
+      /** reset ring data **/
+      N = 0;
+
+      /** get maximum **/
+      int imax = bimax[bev];
+      X0[N] = xmap[imax];
+      Y0[N] = ymap[imax];
+      R[N] = rmap[imax];
+      auto it = std::lower_bound(bedge.begin(), bedge.end(), bev);
+      if (it != bedge.end() && *it == bev) {
+        auto &maximum = full.get_maximum(it - bedge.begin());
+        X0[N] = maximum.x0;
+        Y0[N] = maximum.y0;
+        R[N] = maximum.r;
+      }
+
+      /** fill tree with ring data **/
+      ++N;
+      tout->Fill();
+    }
   }
 
+  if (opt.adaptive)
+    std::cout << " --- adaptive grid: " << n_edges << " / " << nev << " events on the window edge, transformed on the full lattice " << std::endl;
+
   /** free **/
   delete [] xmap;
   delete [] ymap;
   delete [] rmap;
-  delete [] hough;
   
   /** free device memory **/
   hough_free();
@@ -122,7 +214,8 @@ main(int argc, char *argv[])
   fout->cd();
   tout->Write();
   fout->Close();
-  fin->Close();
+  io->close();
+  delete io;
 
   return 0;
 }
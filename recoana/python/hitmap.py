@@ -3,6 +3,7 @@ import uproot
 import matplotlib.pyplot as plt
 import numpy as np
 import awkward as ak
+from recoio import read_xyt
 
 # Check if the filename is provided as a command-line argument
 if len(sys.argv) != 2:
@@ -23,8 +24,7 @@ nev = tin.num_entries
 
 # Define the arrays to store the data
 n = tin["n"].array()
-x_ak = tin["x"].array()
-y_ak = tin["y"].array()
+x_ak, y_ak, _ = read_xyt(fin, tin)
 
 # Flatten the nested arrays
 x_ak_flat = ak.flatten(x_ak)
@@ -1,5 +1,6 @@
 import sys
 import uproot
+from recoio import read_xyt
 
 # Check if the filename is provided as a command-line argument
 if len(sys.argv) != 2:
@@ -20,9 +21,7 @@ nev = tin.num_entries
 
 # Define the arrays to store the data
 n = tin['n'].array()
-x = tin['x'].array()
-y = tin['y'].array()
-t = tin['t'].array()
+x, y, t = read_xyt(fin, tin)
 
 # Loop over the entries
 for i in range(nev):
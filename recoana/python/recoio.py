@@ -0,0 +1,34 @@
+import sys
+import awkward as ak
+
+# Reader of recodata trees in either layout, as lib/recoio.h
+#
+# - float layout: x[n], y[n], t[n] per event
+# - compact layout: id[n] global pixel id and dt[n] integer time per event,
+#   the pixel centres and the time unit are stored once in the "geometry" tree
+#
+# read_xyt() returns x, y, t per event, the compact layout is expanded and
+# hits with a pixel id beyond the geometry table are dropped
+def read_xyt(fin, tin):
+    if "id" not in tin.keys():
+        return tin["x"].array(), tin["y"].array(), tin["t"].array()
+    if "geometry" not in fin:
+        print("ERROR: compact recodata without geometry tree")
+        sys.exit(1)
+    geo = fin["geometry"]
+    geo_x = ak.to_numpy(geo["x"].array()[0])
+    geo_y = ak.to_numpy(geo["y"].array()[0])
+    t_lsb = geo["t_lsb"].array()[0]
+    pid = tin["id"].array()
+    dt = tin["dt"].array()
+    valid = pid < len(geo_x)
+    if not ak.all(valid):
+        print(f"WARNING: dropped {ak.sum(~valid)} hits with pixel id beyond {len(geo_x)}")
+    pid = pid[valid]
+    dt = dt[valid]
+    counts = ak.num(pid)
+    flat = ak.to_numpy(ak.flatten(pid))
+    x = ak.unflatten(geo_x[flat], counts)
+    y = ak.unflatten(geo_y[flat], counts)
+    t = dt * t_lsb
+    return x, y, t